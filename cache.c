@@ -0,0 +1,771 @@
+// On-disk cache of parsed trees (.gast files).
+//
+// A cache file holds the AST of one source, keyed by a hash of its text,
+// so an unchanged source is rebuilt from it without scanning or parsing.
+// The file is position independent: nodes refer to each other by index
+// and to names by index into an atom table, and both are rebuilt in the
+// compilation's arena on load.
+//
+// Nodes are numbered in breadth-first order and stored in that order, so
+// every node comes after the one that refers to it, and its index is
+// implied by the position of the reference. Each record is the
+// node header (kind, coercion, offset, next) followed by the fields of its
+// kind. The variable of an assignment or shift is stored inline.
+//
+// Shared expressions (see make_shared) are the exception: each is stored
+// once, ahead of the tree, and referred to by its index among them. They
+// are stored operands first, so a shared node only refers to shared nodes
+// stored before it. A tree saved with sharing on is only loaded with
+// sharing on, and the other way around.
+
+#include "lexer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC 0x54534147 // "GAST", read in native byte order
+// Bump whenever the layout of the records changes
+#define CACHE_VERSION 2
+
+typedef struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint32_t atom_count;
+  uint32_t node_count; // Of the tree, after the shared ones
+  uint32_t shared_count;
+  uint32_t share; // Whether the tree was built sharing expressions
+  uint64_t atoms_size; // Bytes of the atom table, which the nodes follow
+  uint64_t nodes_size;
+} CacheHeader;
+
+// FNV-1a
+uint64_t hash_source(const Source* source) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < source->size; i++) {
+    hash ^= (unsigned char) source->text[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static char* cache_path(const char* directory, uint64_t hash) {
+  size_t size = strlen(directory) + 32;
+  char* path = malloc(size);
+  snprintf(path, size, "%s/%016llx.gast", directory, (unsigned long long) hash);
+  return path;
+}
+
+// Writing
+
+typedef struct Buffer {
+  char* data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+static void put(Buffer* buffer, const void* data, size_t size) {
+  if (buffer->size + size > buffer->capacity) {
+    buffer->capacity = buffer->capacity == 0 ? 4096 : 2 * buffer->capacity;
+    if (buffer->capacity < buffer->size + size)
+      buffer->capacity = buffer->size + size;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+static void put_u8(Buffer* buffer, uint8_t value) {
+  put(buffer, &value, sizeof(value));
+}
+
+static void put_u32(Buffer* buffer, uint32_t value) {
+  put(buffer, &value, sizeof(value));
+}
+
+// Address -> index + 1, open addressing
+typedef struct Numbering {
+  const void** keys;
+  uint32_t* indices;
+  size_t capacity;
+  uint32_t count;
+} Numbering;
+
+static size_t number_slot(Numbering* numbering, const void* key) {
+  size_t i = ((uintptr_t) key >> 3) * 0x9e3779b97f4a7c15 >> 16;
+  i &= numbering->capacity - 1;
+  while (numbering->keys[i] != NULL && numbering->keys[i] != key)
+    i = (i + 1) & (numbering->capacity - 1);
+  return i;
+}
+
+// The slot of the key, whose key is NULL if it has no index yet. The table
+// grows first, so that one more key fits in it.
+static size_t find_number(Numbering* numbering, const void* key) {
+  if (2 * (numbering->count + 1) > numbering->capacity) {
+    const void** keys = numbering->keys;
+    uint32_t* indices = numbering->indices;
+    size_t capacity = numbering->capacity;
+    numbering->capacity = capacity == 0 ? 1024 : 2 * capacity;
+    numbering->keys = calloc(numbering->capacity, sizeof(void*));
+    numbering->indices = malloc(numbering->capacity * sizeof(uint32_t));
+    for (size_t i = 0; i < capacity; i++) {
+      if (keys[i] != NULL) {
+        size_t slot = number_slot(numbering, keys[i]);
+        numbering->keys[slot] = keys[i];
+        numbering->indices[slot] = indices[i];
+      }
+    }
+    free(keys);
+    free(indices);
+  }
+  return number_slot(numbering, key);
+}
+
+static void free_numbering(Numbering* numbering) {
+  free(numbering->keys);
+  free(numbering->indices);
+}
+
+typedef struct Writer {
+  Buffer atoms;
+  Buffer shared;
+  Buffer nodes;
+  // Where the record being written goes
+  Buffer* out;
+  Numbering atom_numbers;
+  Numbering shared_numbers;
+  // Every node of the tree numbered so far: records are written in this order
+  NodeStack queue;
+} Writer;
+
+static void put_atom(Writer* writer, Atom atom) {
+  if (atom == NULL) {
+    put_u32(writer->out, 0);
+    return;
+  }
+  Numbering* numbers = &writer->atom_numbers;
+  size_t slot = find_number(numbers, atom);
+  if (numbers->keys[slot] == NULL) {
+    numbers->keys[slot] = atom;
+    numbers->indices[slot] = ++numbers->count;
+    uint32_t length = atom_length(atom);
+    put_u32(&writer->atoms, length);
+    put(&writer->atoms, atom, length);
+  }
+  put_u32(writer->out, numbers->indices[slot]);
+}
+
+static void write_node(Writer* writer, Node* node);
+
+// The index + 1 of the shared node, which is written the first time it is
+// asked for, after its operands
+static uint32_t number_shared(Writer* writer, Node* node) {
+  Numbering* numbers = &writer->shared_numbers;
+  size_t slot = find_number(numbers, node);
+  if (numbers->keys[slot] != NULL)
+    return numbers->indices[slot];
+
+  Buffer record;
+  memset(&record, 0, sizeof(record));
+  Buffer* out = writer->out;
+  writer->out = &record;
+  write_node(writer, node);
+  writer->out = out;
+  put(&writer->shared, record.data, record.size);
+  free(record.data);
+
+  // Numbering the operands may have grown the table
+  slot = find_number(numbers, node);
+  numbers->keys[slot] = node;
+  numbers->indices[slot] = ++numbers->count;
+  return numbers->count;
+}
+
+// Numbers the node, to be written after those numbered before it. The
+// reader numbers them in the same order: only whether there is one is
+// stored, unless it is shared.
+static void put_node(Writer* writer, Node* node) {
+  if (node != NULL && node->shared) {
+    uint32_t index = number_shared(writer, node);
+    put_u8(writer->out, 2);
+    put_u32(writer->out, index);
+    return;
+  }
+  put_u8(writer->out, node != NULL);
+  if (node != NULL)
+    push_node(&writer->queue, node);
+}
+
+static void put_type(Writer* writer, TypeNode* type) {
+  if (type == NULL) {
+    put_u8(writer->out, UINT8_MAX);
+    return;
+  }
+  put_u8(writer->out, type->kind);
+  put_atom(writer, type->name);
+}
+
+static void put_fields(Writer* writer, FieldNode* field) {
+  uint32_t count = 0;
+  for (FieldNode* f = field; f != NULL; f = f->next)
+    count++;
+  put_u32(writer->out, count);
+  for (; field != NULL; field = field->next) {
+    put_u8(writer->out, field->scope);
+    put_type(writer, field->type);
+    put_atom(writer, field->identifier);
+  }
+}
+
+static void put_params(Writer* writer, ParamNode* param) {
+  uint32_t count = 0;
+  for (ParamNode* p = param; p != NULL; p = p->next)
+    count++;
+  put_u32(writer->out, count);
+  for (; param != NULL; param = param->next) {
+    put_u32(writer->out, param->offset);
+    put_u8(writer->out, param->is_const);
+    put_type(writer, param->type);
+    put_atom(writer, param->identifier);
+  }
+}
+
+static void put_variable(Writer* writer, VariableNode* var) {
+  put_atom(writer, var->identifier);
+  put_node(writer, var->index);
+  put_atom(writer, var->field);
+}
+
+static void write_node(Writer* writer, Node* node) {
+  Buffer* out = writer->out;
+  NodeValue* value = node->value;
+  put_u8(out, node->type);
+  put_u8(out, node->coerced_to);
+  put_u32(out, node->offset);
+  put_node(writer, node->next);
+
+  switch (node->type) {
+    case INT:
+      put(out, &value->int_node, sizeof(int));
+      break;
+    case FLOAT:
+      put(out, &value->float_node, sizeof(float));
+      break;
+    case BOOL:
+      put_u8(out, value->bool_node);
+      break;
+    case CHAR:
+      put_u8(out, value->char_node);
+      break;
+    case STRING:
+      put_atom(writer, intern(value->string_node.text, value->string_node.length));
+      break;
+    case VARIABLE:
+      put_variable(writer, &value->var_node);
+      break;
+    case BIN_OP:
+      put_node(writer, value->bin_op_node.left);
+      put_node(writer, value->bin_op_node.right);
+      put_u8(out, value->bin_op_node.type);
+      break;
+    case UN_OP:
+      put_node(writer, value->un_op_node.value);
+      put_u8(out, value->un_op_node.type);
+      break;
+    case TERN_OP:
+      put_node(writer, value->tern_op_node.cond);
+      put_node(writer, value->tern_op_node.exp1);
+      put_node(writer, value->tern_op_node.exp2);
+      break;
+    case TYPE_DECL:
+      put_atom(writer, value->type_decl_node.identifier);
+      put_fields(writer, value->type_decl_node.field);
+      break;
+    case GLOBAL_VAR_DECL:
+      put_type(writer, value->global_var_node.type);
+      put_atom(writer, value->global_var_node.identifier);
+      put_u8(out, value->global_var_node.is_static);
+      put(out, &value->global_var_node.array_size, sizeof(int));
+      break;
+    case FUNCTION_DECL:
+      put_type(writer, value->function_decl_node.type);
+      put_atom(writer, value->function_decl_node.identifier);
+      put_u8(out, value->function_decl_node.is_static);
+      put_params(writer, value->function_decl_node.param);
+      put_node(writer, value->function_decl_node.body);
+      break;
+    case VAR_DECL:
+      put_type(writer, value->local_var_node.type);
+      put_atom(writer, value->local_var_node.identifier);
+      put_u8(out, value->local_var_node.is_static);
+      put_u8(out, value->local_var_node.is_const);
+      put_node(writer, value->local_var_node.init);
+      break;
+    case ATTR:
+    case SHIFT_L:
+    case SHIFT_R:
+      put_variable(writer, value->attr_node.var);
+      put_node(writer, value->attr_node.value);
+      break;
+    case FUNCTION_CALL:
+      put_atom(writer, value->function_call_node.identifier);
+      put_node(writer, value->function_call_node.arguments);
+      break;
+    case DOT:
+    case BREAK:
+    case CONTINUE:
+      break;
+    case RETURN:
+    case INPUT:
+    case OUTPUT:
+    case BLOCK:
+      put_node(writer, value->block_node.value);
+      break;
+    case CASE:
+      put(out, &value->case_node, sizeof(int));
+      break;
+    case IF:
+      put_node(writer, value->if_node.cond);
+      put_node(writer, value->if_node.then);
+      put_node(writer, value->if_node.else_node);
+      break;
+    case WHILE:
+    case DO_WHILE:
+      put_node(writer, value->while_node.cond);
+      put_node(writer, value->while_node.body);
+      break;
+    case SWITCH:
+      put_node(writer, value->switch_node.expression);
+      put_node(writer, value->switch_node.body);
+      break;
+    case FOR:
+      put_node(writer, value->for_node.initializers);
+      put_node(writer, value->for_node.expressions);
+      put_node(writer, value->for_node.commands);
+      put_node(writer, value->for_node.body);
+      break;
+    case FOR_EACH:
+      put_atom(writer, value->for_each_node.id);
+      put_node(writer, value->for_each_node.expression);
+      put_node(writer, value->for_each_node.body);
+      break;
+  }
+}
+
+// An empty buffer has no data to write
+static bool write_buffer(const Buffer* buffer, FILE* file) {
+  return buffer->size == 0 || fwrite(buffer->data, 1, buffer->size, file) == buffer->size;
+}
+
+// Writes the tree in the context to the cache in `directory`. Returns 0 on
+// success and -1 with errno set on failure.
+int save_cached_tree(ParseContext* context, const char* directory, uint64_t hash) {
+  Writer writer;
+  memset(&writer, 0, sizeof(writer));
+  writer.out = &writer.nodes;
+  if (context->tree != NULL)
+    push_node(&writer.queue, context->tree);
+  // The queue grows as the records number the nodes they refer to
+  for (size_t i = 0; i < writer.queue.count; i++)
+    write_node(&writer, writer.queue.items[i]);
+
+  CacheHeader header;
+  header.magic = CACHE_MAGIC;
+  header.version = CACHE_VERSION;
+  header.source_hash = hash;
+  header.source_size = context->source.size;
+  header.atom_count = writer.atom_numbers.count;
+  header.node_count = writer.queue.count;
+  header.shared_count = writer.shared_numbers.count;
+  header.share = context->arena.share;
+  header.atoms_size = writer.atoms.size;
+  header.nodes_size = writer.shared.size + writer.nodes.size;
+
+  // Written next to the final file and renamed over it, so a concurrent
+  // compilation never reads a partial file
+  char* path = cache_path(directory, hash);
+  size_t temporary_size = strlen(path) + 16;
+  char* temporary = malloc(temporary_size);
+  snprintf(temporary, temporary_size, "%s.%ld", path, (long) getpid());
+  int ret = -1;
+  FILE* file = fopen(temporary, "wb");
+  if (file != NULL) {
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+      && write_buffer(&writer.atoms, file)
+      && write_buffer(&writer.shared, file)
+      && write_buffer(&writer.nodes, file);
+    if (fclose(file) == 0 && written && rename(temporary, path) == 0)
+      ret = 0;
+    else
+      unlink(temporary);
+  }
+
+  free(temporary);
+  free(path);
+  free(writer.atoms.data);
+  free(writer.shared.data);
+  free(writer.nodes.data);
+  free_numbering(&writer.atom_numbers);
+  free_numbering(&writer.shared_numbers);
+  free_stack(&writer.queue);
+  return ret;
+}
+
+// Reading
+//
+// A file that does not match its header is rejected rather than trusted:
+// every read is bounds checked.
+
+typedef struct Reader {
+  const char* at;
+  const char* end;
+  bool failed;
+
+  Atom* atoms;
+  uint32_t atom_count;
+  // The shared nodes read so far
+  Node** shared;
+  uint32_t shared_count;
+  // Where each node numbered so far goes, once its record is read
+  Node*** slots;
+  uint32_t node_count;
+  uint32_t numbered;
+} Reader;
+
+static void get(Reader* reader, void* data, size_t size) {
+  if ((size_t) (reader->end - reader->at) < size) {
+    reader->failed = true;
+    memset(data, 0, size);
+    return;
+  }
+  memcpy(data, reader->at, size);
+  reader->at += size;
+}
+
+static uint8_t get_u8(Reader* reader) {
+  uint8_t value;
+  get(reader, &value, sizeof(value));
+  return value;
+}
+
+static uint32_t get_u32(Reader* reader) {
+  uint32_t value;
+  get(reader, &value, sizeof(value));
+  return value;
+}
+
+// A value of an enum whose last member is `last`
+static uint8_t get_enum(Reader* reader, uint8_t last) {
+  uint8_t value = get_u8(reader);
+  if (value > last) {
+    reader->failed = true;
+    return 0;
+  }
+  return value;
+}
+
+static Atom get_atom(Reader* reader) {
+  uint32_t index = get_u32(reader);
+  if (index > reader->atom_count) {
+    reader->failed = true;
+    return NULL;
+  }
+  return index == 0 ? NULL : reader->atoms[index - 1];
+}
+
+// The node is filled in once its own record is read, unless it is shared
+static void get_node(Reader* reader, Node** slot) {
+  *slot = NULL;
+  uint8_t tag = get_u8(reader);
+  if (tag == 0)
+    return;
+  if (tag == 2) {
+    uint32_t index = get_u32(reader);
+    if (index == 0 || index > reader->shared_count)
+      reader->failed = true;
+    else
+      *slot = reader->shared[index - 1];
+    return;
+  }
+  if (tag != 1 || reader->numbered == reader->node_count) {
+    reader->failed = true;
+    return;
+  }
+  reader->slots[reader->numbered++] = slot;
+}
+
+static TypeNode* get_type(Reader* reader) {
+  uint8_t kind = get_u8(reader);
+  if (kind == UINT8_MAX)
+    return NULL;
+  Atom name = get_atom(reader);
+  // A class type is known by its name only
+  if (kind > CUSTOM_T || (kind == CUSTOM_T && name == NULL)) {
+    reader->failed = true;
+    return NULL;
+  }
+  return make_type(kind, name);
+}
+
+static FieldNode* get_fields(Reader* reader) {
+  uint32_t count = get_u32(reader);
+  FieldNode* head = NULL;
+  FieldNode** tail = &head;
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    Scope scope = get_enum(reader, NO_SCOPE);
+    TypeNode* type = get_type(reader);
+    *tail = make_field(scope, type, get_atom(reader));
+    tail = &(*tail)->next;
+  }
+  return head;
+}
+
+static ParamNode* get_params(Reader* reader) {
+  uint32_t count = get_u32(reader);
+  ParamNode* head = NULL;
+  ParamNode** tail = &head;
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    Token token;
+    token.offset = get_u32(reader);
+    bool is_const = get_u8(reader);
+    TypeNode* type = get_type(reader);
+    token.value.identifier = get_atom(reader);
+    *tail = make_param(is_const, type, token);
+    tail = &(*tail)->next;
+  }
+  return head;
+}
+
+static VariableNode* get_variable(Reader* reader) {
+  Node* node = make_node(VARIABLE);
+  VariableNode* var = &node->value->var_node;
+  var->identifier = get_atom(reader);
+  get_node(reader, &var->index);
+  var->field = get_atom(reader);
+  var->storage = 0;
+  return var;
+}
+
+static Node* read_node(Reader* reader) {
+  uint8_t type = get_enum(reader, FOR_EACH);
+  if (reader->failed)
+    return NULL;
+  Node* node = make_node(type);
+  uint8_t coerced_to = get_u8(reader);
+  if (coerced_to != UINT8_MAX && coerced_to > CUSTOM_T)
+    reader->failed = true;
+  node->coerced_to = coerced_to;
+  node->offset = get_u32(reader);
+  get_node(reader, &node->next);
+
+  NodeValue* value = node->value;
+  switch (node->type) {
+    case INT:
+      get(reader, &value->int_node, sizeof(int));
+      break;
+    case FLOAT:
+      get(reader, &value->float_node, sizeof(float));
+      break;
+    case BOOL:
+      value->bool_node = get_u8(reader);
+      break;
+    case CHAR:
+      value->char_node = get_u8(reader);
+      break;
+    case STRING:
+      value->string_node.text = get_atom(reader);
+      value->string_node.length = value->string_node.text != NULL ? atom_length(value->string_node.text) : 0;
+      break;
+    case VARIABLE:
+      value->var_node.identifier = get_atom(reader);
+      get_node(reader, &value->var_node.index);
+      value->var_node.field = get_atom(reader);
+      value->var_node.storage = 0;
+      break;
+    case BIN_OP:
+      get_node(reader, &value->bin_op_node.left);
+      get_node(reader, &value->bin_op_node.right);
+      value->bin_op_node.type = get_enum(reader, FORWARD_PIPE);
+      break;
+    case UN_OP:
+      get_node(reader, &value->un_op_node.value);
+      value->un_op_node.type = get_enum(reader, HASH);
+      break;
+    case TERN_OP:
+      get_node(reader, &value->tern_op_node.cond);
+      get_node(reader, &value->tern_op_node.exp1);
+      get_node(reader, &value->tern_op_node.exp2);
+      break;
+    case TYPE_DECL:
+      value->type_decl_node.identifier = get_atom(reader);
+      value->type_decl_node.field = get_fields(reader);
+      break;
+    case GLOBAL_VAR_DECL:
+      value->global_var_node.type = get_type(reader);
+      value->global_var_node.identifier = get_atom(reader);
+      value->global_var_node.is_static = get_u8(reader);
+      get(reader, &value->global_var_node.array_size, sizeof(int));
+      value->global_var_node.storage = 0;
+      break;
+    case FUNCTION_DECL:
+      value->function_decl_node.type = get_type(reader);
+      value->function_decl_node.identifier = get_atom(reader);
+      value->function_decl_node.is_static = get_u8(reader);
+      value->function_decl_node.param = get_params(reader);
+      get_node(reader, &value->function_decl_node.body);
+      break;
+    case VAR_DECL:
+      value->local_var_node.type = get_type(reader);
+      value->local_var_node.identifier = get_atom(reader);
+      value->local_var_node.is_static = get_u8(reader);
+      value->local_var_node.is_const = get_u8(reader);
+      value->local_var_node.storage = 0;
+      get_node(reader, &value->local_var_node.init);
+      break;
+    case ATTR:
+    case SHIFT_L:
+    case SHIFT_R:
+      value->attr_node.var = get_variable(reader);
+      get_node(reader, &value->attr_node.value);
+      break;
+    case FUNCTION_CALL:
+      value->function_call_node.identifier = get_atom(reader);
+      get_node(reader, &value->function_call_node.arguments);
+      break;
+    case DOT:
+    case BREAK:
+    case CONTINUE:
+      break;
+    case RETURN:
+    case INPUT:
+    case OUTPUT:
+    case BLOCK:
+      get_node(reader, &value->block_node.value);
+      break;
+    case CASE:
+      get(reader, &value->case_node, sizeof(int));
+      break;
+    case IF:
+      get_node(reader, &value->if_node.cond);
+      get_node(reader, &value->if_node.then);
+      get_node(reader, &value->if_node.else_node);
+      break;
+    case WHILE:
+    case DO_WHILE:
+      get_node(reader, &value->while_node.cond);
+      get_node(reader, &value->while_node.body);
+      break;
+    case SWITCH:
+      get_node(reader, &value->switch_node.expression);
+      get_node(reader, &value->switch_node.body);
+      break;
+    case FOR:
+      get_node(reader, &value->for_node.initializers);
+      get_node(reader, &value->for_node.expressions);
+      get_node(reader, &value->for_node.commands);
+      get_node(reader, &value->for_node.body);
+      break;
+    case FOR_EACH:
+      value->for_each_node.id = get_atom(reader);
+      get_node(reader, &value->for_each_node.expression);
+      get_node(reader, &value->for_each_node.body);
+      break;
+  }
+  return node;
+}
+
+static bool read_tree(Reader* reader, const CacheHeader* header, Node** tree) {
+  reader->atom_count = header->atom_count;
+  reader->atoms = malloc(header->atom_count * sizeof(Atom));
+  for (uint32_t i = 0; i < header->atom_count && !reader->failed; i++) {
+    uint32_t length = get_u32(reader);
+    if ((size_t) (reader->end - reader->at) < length) {
+      reader->failed = true;
+      break;
+    }
+    reader->atoms[i] = intern(reader->at, length);
+    reader->at += length;
+  }
+
+  // A shared node refers only to those read before it: no node of the tree
+  // is numbered yet, so a reference to one fails
+  reader->shared = malloc(header->shared_count * sizeof(Node*));
+  for (uint32_t i = 0; i < header->shared_count && !reader->failed; i++) {
+    Node* node = read_node(reader);
+    if (node != NULL)
+      node->shared = true;
+    reader->shared[reader->shared_count++] = node;
+  }
+
+  // The root is the first node, and the only one nothing refers to
+  reader->node_count = header->node_count;
+  reader->slots = malloc((header->node_count + 1) * sizeof(Node**));
+  reader->slots[0] = tree;
+  reader->numbered = 1;
+  *tree = NULL;
+  for (uint32_t i = 0; i < header->node_count && !reader->failed; i++) {
+    if (i == reader->numbered) {
+      reader->failed = true; // Nothing refers to it
+      break;
+    }
+    *reader->slots[i] = read_node(reader);
+  }
+
+  free(reader->atoms);
+  free(reader->shared);
+  free(reader->slots);
+  return !reader->failed && reader->at == reader->end;
+}
+
+// Rebuilds the tree of the source installed in the context from the cache
+// in `directory`, in place of yyparse. Returns 0 on success, and -1 if
+// there is no valid cache file for the source.
+int load_cached_tree(ParseContext* context, const char* directory, uint64_t hash) {
+  char* path = cache_path(directory, hash);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return -1;
+  }
+  const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+
+  CacheHeader header;
+  memcpy(&header, data, sizeof(header));
+  int ret = -1;
+  if (header.magic == CACHE_MAGIC
+      && header.version == CACHE_VERSION
+      && header.source_hash == hash
+      && header.source_size == context->source.size
+      && header.share == context->arena.share
+      && header.atom_count <= header.atoms_size
+      && (uint64_t) header.node_count + header.shared_count <= header.nodes_size
+      && sizeof(header) + header.atoms_size + header.nodes_size == (size_t) st.st_size) {
+    Reader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.at = data + sizeof(header);
+    reader.end = reader.at + header.atoms_size + header.nodes_size;
+
+    use_arena(&context->arena);
+    Node* tree;
+    if (read_tree(&reader, &header, &tree)) {
+      context->tree = tree;
+      context->invalid_input = false;
+      context->error_count = 0;
+      ret = 0;
+    }
+  }
+  munmap((void*) data, st.st_size);
+  return ret;
+}
@@ -0,0 +1,101 @@
+// ParseContext management, shared by both scanner backends
+
+#include "lexer.h"
+
+void init_context(ParseContext* context) {
+  context->tree = NULL;
+  init_arena(&context->arena);
+  context->invalid_input = false;
+  context->scan_offset = 0;
+  init_source(&context->source);
+  context->buffer = NULL;
+  context->tokens = NULL;
+  context->token_count = 0;
+  context->token_index = 0;
+  context->declaration_parsed = NULL;
+  context->declaration_data = NULL;
+  yylex_init_extra(context, &context->scanner);
+}
+
+// Releases the AST too, unless libera already did
+void destroy_context(ParseContext* context) {
+  free_arena(&context->arena);
+  use_arena(NULL);
+  release_source(context);
+  yylex_destroy(context->scanner);
+  context->scanner = NULL;
+}
+
+// Makes `source` the input of the next yyparse/yylex calls
+static void scan_source(ParseContext* context, Source source) {
+  release_source(context);
+  context->source = source;
+  context->scan_offset = 0;
+  // The size given to flex includes its two terminating NULs
+  context->buffer = yy_scan_buffer(source.text, source.size + 2, context->scanner);
+}
+
+// Maps the whole file and scans it in place. Returns 0 on success and -1
+// (with errno set) if the file cannot be opened or mapped.
+int scan_file(ParseContext* context, const char* path) {
+  Source source;
+  if (map_source(&source, path) < 0)
+    return -1;
+  scan_source(context, source);
+  return 0;
+}
+
+void scan_stream(ParseContext* context, FILE* stream) {
+  Source source;
+  read_source(&source, stream);
+  scan_source(context, source);
+}
+
+void scan_text(ParseContext* context, const char* text, size_t size) {
+  Source source;
+  copy_source(&source, text, size);
+  scan_source(context, source);
+}
+
+// Must only be called once the AST built from the source is released
+void release_source(ParseContext* context) {
+  if (context->buffer != NULL)
+    yy_delete_buffer(context->buffer, context->scanner);
+  context->buffer = NULL;
+  free_source(&context->source);
+  free(context->tokens);
+  context->tokens = NULL;
+  context->token_count = 0;
+  context->token_index = 0;
+}
+
+void get_position(ParseContext* context, uint32_t offset, int* line, int* column) {
+  // The first call builds the line table from the text, where the scanner
+  // has NUL terminated the current token: put the original byte back while
+  // it is read
+  char hold_char, current;
+  char* hold = NULL;
+  if (context->source.line_starts == NULL)
+    hold = scanner_hold(context->scanner, &hold_char);
+  if (hold != NULL) {
+    current = *hold;
+    *hold = hold_char;
+  }
+  source_position(&context->source, offset, line, column);
+  if (hold != NULL)
+    *hold = current;
+}
+
+// Position of the end of the text scanned so far, for syntax errors
+
+int get_line_number(ParseContext* context) {
+  int line, column;
+  get_position(context, context->scan_offset, &line, &column);
+  return line;
+}
+
+int get_column_number(ParseContext* context) {
+  int line, column;
+  get_position(context, context->scan_offset, &line, &column);
+  return column;
+}
@@ -0,0 +1,63 @@
+// The options of main.c and what they change in each step of a compilation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "driver.h"
+#include "semantic.h"
+#include "iloc.h"
+
+static void read_options(Driver* driver) {
+  driver->share_expressions = getenv("SHARE_EXPRESSIONS") != NULL;
+  driver->fused = getenv("FUSED_PASS") != NULL;
+  driver->cache = getenv("GAST_CACHE");
+}
+
+int start_driver(Driver* driver, ParseContext* context, int argc, char** argv) {
+  driver->context = context;
+  driver->parsed = false;
+  read_options(driver);
+  init_context(context);
+  if (argc > 1) {
+    if (scan_file(context, argv[1]) != 0) {
+      perror(argv[1]);
+      destroy_context(context);
+      return 1;
+    }
+  } else
+    scan_stream(context, stdin);
+  if (driver->share_expressions)
+    share_expressions(&context->arena, true);
+  driver->hash = driver->cache != NULL ? hash_source(&context->source) : 0;
+  return 0;
+}
+
+int parse_input(Driver* driver) {
+  ParseContext* context = driver->context;
+  if (driver->cache != NULL && load_cached_tree(context, driver->cache, driver->hash) == 0)
+    return 0;
+  if (context->source.size >= PRELEX_MIN_SIZE)
+    prelex(context, sysconf(_SC_NPROCESSORS_ONLN));
+  driver->parsed = true;
+  return yyparse(context->scanner);
+}
+
+int check_input(Driver* driver, Node* tree) {
+  int ret = driver->fused ? compile_program(tree, &driver->context->source)
+                          : check_program(tree, &driver->context->source);
+  // Once checked, so the coercions found are cached too
+  if (driver->cache != NULL && driver->parsed && tree != NULL
+      && save_cached_tree(driver->context, driver->cache, driver->hash) != 0)
+    perror(driver->cache);
+  return ret;
+}
+
+// The fused pass has written the code already
+void generate_input(Driver* driver, Node* tree) {
+  if (!driver->fused)
+    generate_code(tree);
+}
+
+void stop_driver(Driver* driver) {
+  destroy_context(driver->context);
+}
@@ -0,0 +1,36 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+// What main.c does with a program, beyond what the assignment's version
+// does, kept here so main.c stays as close to it as it can. The options
+// come from the environment, see README.md.
+
+#include "lexer.h"
+
+typedef struct {
+  ParseContext* context;
+  // SHARE_EXPRESSIONS: each distinct side-effect-free expression is built
+  // once and shared by all its occurrences, see tree.c
+  bool share_expressions;
+  // FUSED_PASS: the code of each construct is emitted as soon as it is
+  // checked, in a single walk of the tree
+  bool fused;
+  // GAST_CACHE: directory where the trees of the sources parsed before
+  // are kept, see cache.c. NULL if unset.
+  const char* cache;
+  uint64_t hash;
+  // Whether the tree came from the parser rather than the cache
+  bool parsed;
+} Driver;
+
+// Reads the options and sets up the context on the file named by the
+// first argument, or on stdin. Returns 1 if the file cannot be read.
+int start_driver(Driver* driver, ParseContext* context, int argc, char** argv);
+// The tree in context->tree, from the cache or the parser, with
+// yyparse's result
+int parse_input(Driver* driver);
+int check_input(Driver* driver, Node* tree);
+void generate_input(Driver* driver, Node* tree);
+void stop_driver(Driver* driver);
+
+#endif
@@ -0,0 +1,260 @@
+// Hand-written precedence climbing parser for expressions.
+//
+// The grammar in parser.y reaches an expression through a dozen unit
+// reductions per operand. Instead, the `expression` and `arguments` rules
+// match no tokens themselves: their actions call in here, and this parser
+// reads the tokens of the expression and hands the one that follows back to
+// bison as its lookahead. The trees built are exactly those of the former
+// grammar rules.
+
+#include "lexer.h"
+
+// Binding power of the binary operators, from loosest to tightest. All of
+// them are left associative but the ternary operator.
+enum {
+  PIPE = 1,
+  TERNARY,
+  LOGICAL_OR,
+  LOGICAL_AND,
+  RELATIONAL,
+  ADDITIVE,
+  MULTIPLICATIVE,
+  EXPONENTIATION
+};
+
+typedef struct Parser {
+  void* scanner;
+  // Bison's lookahead, which is the current token here
+  int* type;
+  YYSTYPE* lval;
+  // Bison is recovering from an earlier error and reports none for now
+  bool quiet;
+} Parser;
+
+static void advance(Parser* parser) {
+  *parser->type = next_token(parser->lval, parser->scanner);
+}
+
+static void error(Parser* parser, int expected) {
+  if (!parser->quiet)
+    syntax_error(parser->scanner, *parser->type, expected);
+}
+
+static bool expect(Parser* parser, int type) {
+  if (*parser->type != type) {
+    error(parser, type);
+    return false;
+  }
+  advance(parser);
+  return true;
+}
+
+// 0 if the token is not a binary operator
+static int precedence(int type) {
+  switch (type) {
+    case TK_OC_BASH_PIPE: case TK_OC_FORWARD_PIPE:
+      return PIPE;
+    case '?':
+      return TERNARY;
+    case TK_OC_OR: case '|':
+      return LOGICAL_OR;
+    case TK_OC_AND: case '&':
+      return LOGICAL_AND;
+    case TK_OC_EQ: case TK_OC_NE: case TK_OC_GE: case TK_OC_LE: case '>': case '<':
+      return RELATIONAL;
+    case '+': case '-':
+      return ADDITIVE;
+    case '*': case '/': case '%':
+      return MULTIPLICATIVE;
+    case '^':
+      return EXPONENTIATION;
+    default:
+      return 0;
+  }
+}
+
+static BinOpType binary_operator(int type, Token* token) {
+  switch (type) {
+    case '|': return BIT_OR;
+    case '&': return BIT_AND;
+    case '>': return GREATER;
+    case '<': return LESS_THAN;
+    case '+': return ADD;
+    case '-': return SUBTRACT;
+    case '*': return MULTIPLY;
+    case '/': return DIVIDE;
+    case '%': return MODULO;
+    case '^': return POW;
+    // The scanner already tells which operator it is
+    default: return token->value.binary_operator;
+  }
+}
+
+static bool unary_operator(int type, UnOpType* op) {
+  switch (type) {
+    case '!': *op = NOT; return true;
+    case '-': *op = MINUS; return true;
+    case '+': *op = PLUS; return true;
+    case '*': *op = VALUE; return true;
+    case '&': *op = ADDRESS; return true;
+    case '?': *op = EVAL_BOOL; return true;
+    case '#': *op = HASH; return true;
+    default: return false;
+  }
+}
+
+static Node* parse_binary(Parser* parser, int min_precedence);
+
+static bool parse_argument_list(Parser* parser, Node** arguments) {
+  *arguments = NULL;
+  if (*parser->type == ')')
+    return true;
+
+  Node* tail = NULL;
+  while (true) {
+    Node* argument;
+    if (*parser->type == '.') {
+      advance(parser);
+      argument = make_dot();
+    } else if ((argument = parse_binary(parser, PIPE)) == NULL) {
+      *arguments = NULL;
+      return false;
+    }
+    argument = unshared(argument);
+    if (tail != NULL)
+      tail->next = argument;
+    else
+      *arguments = argument;
+    tail = argument;
+
+    if (*parser->type != ',')
+      return true;
+    advance(parser);
+  }
+}
+
+// A variable access or a function call, once its identifier is read
+static Node* parse_access(Parser* parser, Token token) {
+  if (*parser->type == '(') {
+    advance(parser);
+    Node* arguments;
+    if (!parse_argument_list(parser, &arguments))
+      return NULL;
+    if (!expect(parser, ')'))
+      return NULL;
+    return make_function_call(token.value.identifier, arguments);
+  }
+
+  Node* index = NULL;
+  Atom field = NULL;
+  if (*parser->type == '[') {
+    advance(parser);
+    if ((index = parse_binary(parser, PIPE)) == NULL)
+      return NULL;
+    if (!expect(parser, ']'))
+      return NULL;
+  }
+  if (*parser->type == '$') {
+    advance(parser);
+    if (*parser->type != TK_IDENTIFICADOR) {
+      error(parser, TK_IDENTIFICADOR);
+      return NULL;
+    }
+    field = parser->lval->token.value.identifier;
+    advance(parser);
+  }
+  return make_variable(token, index, field);
+}
+
+static Node* parse_operand(Parser* parser) {
+  Token token = parser->lval->token;
+  switch (*parser->type) {
+    case TK_LIT_INT:
+      advance(parser);
+      return make_int(token.value.int_literal);
+    case TK_LIT_FLOAT:
+      advance(parser);
+      return make_float(token.value.float_literal);
+    case TK_LIT_CHAR:
+      advance(parser);
+      return make_char(token.value.char_literal);
+    case TK_LIT_STRING:
+      advance(parser);
+      return make_string(token.value.string_literal);
+    case TK_LIT_TRUE:
+    case TK_LIT_FALSE:
+      advance(parser);
+      return make_bool(token.value.bool_literal);
+    case TK_IDENTIFICADOR:
+      advance(parser);
+      return parse_access(parser, token);
+    case '(': {
+      advance(parser);
+      Node* expression = parse_binary(parser, PIPE);
+      if (expression != NULL && !expect(parser, ')'))
+        return NULL;
+      return expression;
+    }
+    default:
+      error(parser, YYEMPTY);
+      return NULL;
+  }
+}
+
+static Node* parse_unary(Parser* parser) {
+  UnOpType op;
+  if (!unary_operator(*parser->type, &op))
+    return parse_operand(parser);
+  advance(parser);
+  Node* value = parse_unary(parser);
+  return value == NULL ? NULL : make_un_op(value, op);
+}
+
+// Parses operators that bind at least as tight as `min_precedence`
+static Node* parse_binary(Parser* parser, int min_precedence) {
+  Node* left = parse_unary(parser);
+  int current;
+  while (left != NULL && (current = precedence(*parser->type)) >= min_precedence) {
+    if (*parser->type == '?') {
+      // The condition binds tighter than the ternary operator, the middle
+      // is a whole expression and the ternary operator nests to the right
+      advance(parser);
+      Node* exp1 = parse_binary(parser, PIPE);
+      Node* exp2 = NULL;
+      if (exp1 != NULL && expect(parser, ':'))
+        exp2 = parse_binary(parser, TERNARY);
+      if (exp2 == NULL)
+        return NULL;
+      left = make_tern_op(left, exp1, exp2);
+    } else {
+      BinOpType op = binary_operator(*parser->type, &parser->lval->token);
+      advance(parser);
+      Node* right = parse_binary(parser, current + 1);
+      if (right == NULL)
+        return NULL;
+      left = make_bin_op(left, op, right);
+    }
+  }
+  return left;
+}
+
+static void start(Parser* parser, void* scanner, int* lookahead, YYSTYPE* lval, bool recovering) {
+  parser->scanner = scanner;
+  parser->type = lookahead;
+  parser->lval = lval;
+  parser->quiet = recovering;
+  if (*lookahead == YYEMPTY)
+    advance(parser);
+}
+
+Node* parse_expression(void* scanner, int* lookahead, YYSTYPE* lval, bool recovering) {
+  Parser parser;
+  start(&parser, scanner, lookahead, lval, recovering);
+  return parse_binary(&parser, PIPE);
+}
+
+bool parse_arguments(void* scanner, int* lookahead, YYSTYPE* lval, bool recovering, Node** arguments) {
+  Parser parser;
+  start(&parser, scanner, lookahead, lval, recovering);
+  return parse_argument_list(&parser, arguments);
+}
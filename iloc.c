@@ -7,173 +7,743 @@ int label_counter = 0;
 int global_offset = 0;
 int local_offset = 0;
 Memory* global_memory = NULL;
+FILE* code_output = NULL;
 
-void generate_code(Node* node) {
-    if (node == NULL) {
+// The memory of each numbered declaration generated so far, by number
+static Memory** numbered = NULL;
+static uint32_t numbered_capacity = 0;
+
+static void number_memory(Memory* mem, uint32_t storage) {
+    mem->storage = storage;
+    if (storage == 0)
         return;
+    if (storage >= numbered_capacity) {
+        uint32_t capacity = numbered_capacity == 0 ? 1024 : numbered_capacity;
+        while (capacity <= storage)
+            capacity *= 2;
+        numbered = realloc(numbered, capacity * sizeof(Memory*));
+        memset(numbered + numbered_capacity, 0, (capacity - numbered_capacity) * sizeof(Memory*));
+        numbered_capacity = capacity;
     }
+    numbered[storage] = mem;
+}
+
+static FILE* out() {
+    return code_output != NULL ? code_output : stdout;
+}
+
+// Registers that hold the value of shared expressions already computed in
+// the current basic block, so that other uses of them copy it instead of
+// computing it again. Each records the variables its expression reads as
+// bits of a mask, to forget it when one of them is stored to.
+#define MAX_VALUES 128
+
+typedef struct {
+    Node* node;
+    int reg;
+    uint64_t reads;
+} Value;
+
+static Value values[MAX_VALUES];
+static int value_count = 0;
+
+// A label starts a basic block, which may be reached from where the values
+// were never computed
+static void start_block() {
+    value_count = 0;
+}
+
+// Taken from the text of the name, so that the values kept do not depend
+// on where it was interned, as when the tree is loaded from a cache
+static uint64_t variable_bit(Atom id) {
+    return (uint64_t) 1 << (atom_hash(id) % 64);
+}
+
+static Value* find_value(Node* node) {
+    for (int i = 0; i < value_count; i++)
+        if (values[i].node == node)
+            return &values[i];
+    return NULL;
+}
+
+// Variables read by a shared operand, as far as the values kept tell
+static uint64_t operand_reads(Node* node) {
+    if (node->type == INT || node->type == FLOAT || node->type == BOOL || node->type == CHAR)
+        return 0;
+    Value* value = find_value(node);
+    return value != NULL ? value->reads : ~(uint64_t) 0;
+}
+
+// Records reg_counter as the value of `node`, once its code is generated
+static void remember_value(Node* node) {
+    uint64_t reads;
     switch (node->type) {
-    case GLOBAL_VAR_DECL:
-        global_var_code(node->value->global_var_node);
+    case VARIABLE: {
+        VariableNode var = node->value->var_node;
+        reads = variable_bit(var.identifier);
+        if (var.index != NULL)
+            reads |= operand_reads(var.index);
+        break; }
+    case UN_OP:
+        reads = operand_reads(node->value->un_op_node.value);
         break;
-    case FUNCTION_DECL:
-        generate_code(node->value->function_decl_node.body);
+    case BIN_OP:
+        reads = operand_reads(node->value->bin_op_node.left)
+              | operand_reads(node->value->bin_op_node.right);
         break;
+    default:
+        return;
+    }
+    if (value_count == MAX_VALUES)
+        start_block();
+    values[value_count++] = (Value) {node, reg_counter, reads};
+}
+
+static void forget_values(Atom stored) {
+    uint64_t bit = variable_bit(stored);
+    int kept = 0;
+    for (int i = 0; i < value_count; i++)
+        if (!(values[i].reads & bit))
+            values[kept++] = values[i];
+    value_count = kept;
+}
+
+void forget_name(Atom id) {
+    forget_values(id);
+}
+
+bool reuse_value(Node* node) {
+    Value* value = find_value(node);
+    if (value == NULL)
+        return false;
+    fprintf(out(), "i2i r%d => r%d", value->reg, new_reg());
+    fprintf(out(), " // r%d = r%d, computed before\n", reg_counter, value->reg);
+    return true;
+}
+
+// Statements follow each other in a loop: a block has any number of them
+void generate_code(Node* node) {
+    for (; node != NULL; node = node->next) {
+        if (node->shared && reuse_value(node))
+            continue;
+        switch (node->type) {
+        case GLOBAL_VAR_DECL:
+        case FUNCTION_DECL:
+            generate_declaration(node);
+            break;
+        case BLOCK:
+            generate_code(node->value->block_node.value);
+            break;
+        case VAR_DECL:
+            local_var_code(node);
+            break;
+        case ATTR:
+            attr_code(node->value->attr_node);
+            break;
+        case INT:
+            int_code(node->value->int_node);
+            break;
+        case VARIABLE:
+            var_access_code(node, variable_memory(&node->value->var_node));
+            break;
+        case BIN_OP:
+            bin_op_code(node);
+            break;
+        case UN_OP:
+            un_op_code(node);
+            break;
+        case IF:
+            if_code(node->value->if_node);
+            break;
+        case WHILE:
+            while_code(node->value->while_node);
+            break;
+        case DO_WHILE:
+            do_while_code(node->value->do_while_node);
+            break;
+        case FOR_EACH:
+            forget_name(node->value->for_each_node.id);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Whether bin_op_code has anything to generate for the operator
+static bool op_has_code(BinOpType type) {
+    switch(type) {
+    case AND:
+    case OR:
+    case GREATER:
+    case LESS_THAN:
+    case GREATER_EQUAL:
+    case LESS_EQUAL:
+    case EQUAL:
+    case NOT_EQUAL:
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Declarations are all walked, even those without code of their own
+bool has_code(Node* node) {
+    switch (node->type) {
+    case GLOBAL_VAR_DECL:
+    case TYPE_DECL:
+    case FUNCTION_DECL:
     case BLOCK:
-        generate_code(node->value->block_node.value);
-        break;
     case VAR_DECL:
-        local_var_code(node->value->local_var_node);
-        break;
     case ATTR:
-        attr_code(node->value->attr_node);
-        break;
     case INT:
-        int_code(node->value->int_node);
-        break;
     case VARIABLE:
-        var_access_code(node->value->var_node);
-        break;
-    case BIN_OP:
-        bin_op_code(node->value->bin_op_node);
-        break;
     case UN_OP:
-        un_op_code(node->value->un_op_node);
-        break;
     case IF:
-        if_code(node->value->if_node);
-        break;
     case WHILE:
-        while_code(node->value->while_node);
-        break;
     case DO_WHILE:
-        do_while_code(node->value->do_while_node);
-        break;
+    case FOR_EACH:
+        return true;
+    case BIN_OP:
+        return op_has_code(node->value->bin_op_node.type);
     default:
-        break;
+        return false;
+    }
+}
+
+// Code for a single global declaration, without moving on to the next
+void generate_declaration(Node* node) {
+    if (node->type == GLOBAL_VAR_DECL)
+        global_var_code(node->value->global_var_node);
+    else if (node->type == FUNCTION_DECL) {
+        Memory* outer = begin_function(node, NULL);
+        generate_code(node->value->function_decl_node.body);
+        end_function(outer);
+    }
+}
+
+// Frame layout
+//
+// Each function lays out its locals before its code is generated. A local
+// lives from its declaration to its last use, and on to the end of any
+// loop entered after it that it is used in, as the loop comes back to it.
+// Locals that do not live at the same time share a slot: those of sibling
+// blocks, say, as the checker has no scopes for blocks.
+
+typedef struct {
+    Node* decl;
+    int start;
+    int end;
+    int size;
+    // The last loop, by number, it has to outlive; -1 if none
+    int loop;
+} Local;
+
+typedef struct {
+    const void* key;
+    int value;
+} MapEntry;
+
+// Open addressing with linear probing; capacity is always a power of two
+typedef struct {
+    MapEntry* entries;
+    size_t count;
+    size_t capacity;
+} PointerMap;
+
+static size_t pointer_hash(const void* key) {
+    uint64_t h = (uintptr_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static MapEntry* map_find(PointerMap* map, const void* key) {
+    size_t mask = map->capacity - 1;
+    size_t i = pointer_hash(key) & mask;
+    while (map->entries[i].key != NULL && map->entries[i].key != key)
+        i = (i + 1) & mask;
+    return &map->entries[i];
+}
+
+static void map_put(PointerMap* map, const void* key, int value) {
+    if (2 * (map->count + 1) > map->capacity) {
+        PointerMap grown = {NULL, map->count, map->capacity == 0 ? 64 : 2 * map->capacity};
+        grown.entries = calloc(grown.capacity, sizeof(MapEntry));
+        for (size_t i = 0; i < map->capacity; i++)
+            if (map->entries[i].key != NULL)
+                *map_find(&grown, map->entries[i].key) = map->entries[i];
+        free(map->entries);
+        *map = grown;
+    }
+    MapEntry* entry = map_find(map, key);
+    if (entry->key == NULL)
+        map->count++;
+    *entry = (MapEntry) {key, value};
+}
+
+// -1 if not there
+static int map_get(PointerMap* map, const void* key) {
+    if (map->capacity == 0)
+        return -1;
+    MapEntry* entry = map_find(map, key);
+    return entry->key != NULL ? entry->value : -1;
+}
+
+static void map_free(PointerMap* map) {
+    free(map->entries);
+    *map = (PointerMap) {NULL, 0, 0};
+}
+
+// The offset of each local of the function being generated, by declaration
+static PointerMap frame_slots;
+
+typedef struct {
+    int start;
+    int number;
+} OpenLoop;
+
+typedef struct {
+    Local* locals;
+    size_t count;
+    size_t capacity;
+    // The local each name refers to so far
+    PointerMap names;
+    OpenLoop* loops;
+    size_t depth;
+    size_t loops_capacity;
+    // Where each loop ends, by number
+    int* loop_ends;
+    int loop_count;
+} Liveness;
+
+// Markers on the stack of the walk, in the low bits of a node's address
+#define CLOSE_LOOP 1
+#define DECLARE 2
+
+static void use_name(Liveness* live, Atom name, int position) {
+    int i = map_get(&live->names, name);
+    if (i < 0)
+        return;
+    Local* local = &live->locals[i];
+    local->end = position;
+    // The outermost loop open since the declaration
+    size_t low = 0, high = live->depth;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (live->loops[middle].start > local->start)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    if (low < live->depth)
+        local->loop = live->loops[low].number;
+}
+
+static void push_marked(NodeStack* stack, Node* node, uintptr_t mark) {
+    push_node(stack, (Node*) ((uintptr_t) node | mark));
+}
+
+// Children are pushed last first, to be visited in the order they are in
+static void push_child(NodeStack* stack, Node* node) {
+    if (node != NULL)
+        push_node(stack, node);
+}
+
+static void push_list(NodeStack* stack, Node* list) {
+    size_t first = stack->count;
+    for (; list != NULL; list = list->next)
+        push_node(stack, list);
+    for (size_t i = first, j = stack->count; i + 1 < j; i++, j--) {
+        Node* node = stack->items[i];
+        stack->items[i] = stack->items[j - 1];
+        stack->items[j - 1] = node;
+    }
+}
+
+static int slot_size(TypeNode* type, SymbolsTable* table) {
+    // Without a table, classes are as big as the last check found them
+    int size = type->kind == CUSTOM_T && table == NULL ? type->size : size_for_type(type, table);
+    // Values are loaded and stored a word at a time
+    if (size < 4)
+        return 4;
+    return (size + 3) & ~3;
+}
+
+static void find_liveness(Liveness* live, Node* body, SymbolsTable* table) {
+    NodeStack stack = {0};
+    push_list(&stack, body);
+    int position = 0;
+    while (stack.count > 0) {
+        Node* node = pop_node(&stack);
+        uintptr_t mark = (uintptr_t) node & 3;
+        node = (Node*) ((uintptr_t) node & ~(uintptr_t) 3);
+        position++;
+        if (mark == CLOSE_LOOP) {
+            live->loop_ends[live->loops[--live->depth].number] = position;
+            continue;
+        }
+        if (mark == DECLARE) {
+            // After the initializer, which still sees what the name was
+            map_put(&live->names, node->value->local_var_node.identifier, live->count);
+            if (live->count == live->capacity) {
+                live->capacity = live->capacity == 0 ? 64 : 2 * live->capacity;
+                live->locals = realloc(live->locals, live->capacity * sizeof(Local));
+            }
+            int size = slot_size(node->value->local_var_node.type, table);
+            live->locals[live->count++] = (Local) {node, position, position, size, -1};
+            continue;
+        }
+
+        switch (node->type) {
+        case WHILE:
+        case DO_WHILE:
+        case FOR:
+        case FOR_EACH:
+            if (live->depth == live->loops_capacity) {
+                live->loops_capacity = live->loops_capacity == 0 ? 16 : 2 * live->loops_capacity;
+                live->loops = realloc(live->loops, live->loops_capacity * sizeof(OpenLoop));
+            }
+            if (live->loop_count % 64 == 0)
+                live->loop_ends = realloc(live->loop_ends, (live->loop_count + 64) * sizeof(int));
+            live->loops[live->depth++] = (OpenLoop) {position, live->loop_count++};
+            push_marked(&stack, node, CLOSE_LOOP);
+            break;
+        default:
+            break;
+        }
+
+        switch (node->type) {
+        case VARIABLE:
+            use_name(live, node->value->var_node.identifier, position);
+            push_child(&stack, node->value->var_node.index);
+            break;
+        case BIN_OP:
+            push_child(&stack, node->value->bin_op_node.right);
+            push_child(&stack, node->value->bin_op_node.left);
+            break;
+        case UN_OP:
+            push_child(&stack, node->value->un_op_node.value);
+            break;
+        case TERN_OP:
+            push_child(&stack, node->value->tern_op_node.exp2);
+            push_child(&stack, node->value->tern_op_node.exp1);
+            push_child(&stack, node->value->tern_op_node.cond);
+            break;
+        case VAR_DECL:
+            push_marked(&stack, node, DECLARE);
+            push_child(&stack, node->value->local_var_node.init);
+            break;
+        case ATTR:
+        case SHIFT_L:
+        case SHIFT_R:
+            use_name(live, node->value->attr_node.var->identifier, position);
+            push_child(&stack, node->value->attr_node.value);
+            push_child(&stack, node->value->attr_node.var->index);
+            break;
+        case FUNCTION_CALL:
+            push_list(&stack, node->value->function_call_node.arguments);
+            break;
+        case RETURN:
+        case INPUT:
+        case OUTPUT:
+        case BLOCK:
+            push_list(&stack, node->value->block_node.value);
+            break;
+        case IF:
+            push_child(&stack, node->value->if_node.else_node);
+            push_child(&stack, node->value->if_node.then);
+            push_child(&stack, node->value->if_node.cond);
+            break;
+        case WHILE:
+            push_child(&stack, node->value->while_node.body);
+            push_child(&stack, node->value->while_node.cond);
+            break;
+        case DO_WHILE:
+            push_child(&stack, node->value->do_while_node.cond);
+            push_child(&stack, node->value->do_while_node.body);
+            break;
+        case SWITCH:
+            push_child(&stack, node->value->switch_node.body);
+            push_child(&stack, node->value->switch_node.expression);
+            break;
+        case FOR:
+            push_child(&stack, node->value->for_node.body);
+            push_list(&stack, node->value->for_node.commands);
+            push_list(&stack, node->value->for_node.expressions);
+            push_list(&stack, node->value->for_node.initializers);
+            break;
+        case FOR_EACH:
+            push_child(&stack, node->value->for_each_node.body);
+            push_list(&stack, node->value->for_each_node.expression);
+            break;
+        default:
+            break;
+        }
+    }
+    free_stack(&stack);
+
+    for (size_t i = 0; i < live->count; i++) {
+        Local* local = &live->locals[i];
+        if (local->loop >= 0 && live->loop_ends[local->loop] > local->end)
+            local->end = live->loop_ends[local->loop];
     }
+}
+
+// Locals still live, as a heap on where they end
+static void sift_down(Local** heap, size_t count, size_t i) {
+    for (;;) {
+        size_t least = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && heap[left]->end < heap[least]->end)
+            least = left;
+        if (right < count && heap[right]->end < heap[least]->end)
+            least = right;
+        if (least == i)
+            return;
+        Local* local = heap[i];
+        heap[i] = heap[least];
+        heap[least] = local;
+        i = least;
+    }
+}
+
+static void sift_up(Local** heap, size_t i) {
+    while (i > 0 && heap[(i - 1) / 2]->end > heap[i]->end) {
+        Local* local = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = local;
+        i = (i - 1) / 2;
+    }
+}
+
+typedef struct {
+    int size;
+    int* offsets;
+    size_t count;
+    size_t capacity;
+} FreeSlots;
+
+// Gives each local a slot in frame_slots, in the order they are declared
+// in, and returns the size of the frame
+static int assign_slots(Liveness* live) {
+    Local** heap = malloc((live->count + 1) * sizeof(Local*));
+    size_t live_count = 0;
+    FreeSlots* free_slots = NULL;
+    size_t sizes = 0;
+    int frame = 0;
+    for (size_t i = 0; i < live->count; i++) {
+        Local* local = &live->locals[i];
+        while (live_count > 0 && heap[0]->end < local->start) {
+            Local* dead = heap[0];
+            heap[0] = heap[--live_count];
+            sift_down(heap, live_count, 0);
+            size_t k = 0;
+            while (k < sizes && free_slots[k].size != dead->size)
+                k++;
+            if (k == sizes) {
+                free_slots = realloc(free_slots, ++sizes * sizeof(FreeSlots));
+                free_slots[k] = (FreeSlots) {dead->size, NULL, 0, 0};
+            }
+            FreeSlots* slots = &free_slots[k];
+            if (slots->count == slots->capacity) {
+                slots->capacity = slots->capacity == 0 ? 16 : 2 * slots->capacity;
+                slots->offsets = realloc(slots->offsets, slots->capacity * sizeof(int));
+            }
+            slots->offsets[slots->count++] = map_get(&frame_slots, dead->decl);
+        }
+
+        int offset = -1;
+        for (size_t k = 0; k < sizes; k++)
+            if (free_slots[k].size == local->size && free_slots[k].count > 0)
+                offset = free_slots[k].offsets[--free_slots[k].count];
+        if (offset < 0) {
+            offset = frame;
+            frame += local->size;
+        }
+        map_put(&frame_slots, local->decl, offset);
+        heap[live_count++] = local;
+        sift_up(heap, live_count - 1);
+    }
+    for (size_t k = 0; k < sizes; k++)
+        free(free_slots[k].offsets);
+    free(free_slots);
+    free(heap);
+    return frame;
+}
+
+Memory* begin_function(Node* function, SymbolsTable* table) {
+    Liveness live = {0};
+    find_liveness(&live, function->value->function_decl_node.body, table);
+    map_free(&frame_slots);
+    local_offset = assign_slots(&live);
+    free(live.locals);
+    map_free(&live.names);
+    free(live.loops);
+    free(live.loop_ends);
+
+    fprintf(out(), "// frame of %s: %d bytes\n", function->value->function_decl_node.identifier, local_offset);
+    start_block();
+    for (ParamNode* param = function->value->function_decl_node.param; param != NULL; param = param->next)
+        forget_name(param->identifier);
+    return global_memory;
+}
 
-    generate_code(node->next);
+// Forgets the locals of the function, so that the names used after it are
+// found where the checker finds them
+void end_function(Memory* outer) {
+    while (global_memory != outer) {
+        Memory* mem = global_memory;
+        global_memory = mem->next;
+        if (mem->storage != 0)
+            numbered[mem->storage] = NULL;
+        free(mem);
+    }
+    map_free(&frame_slots);
 }
 
-void global_var_code(GlobalVarNode var_node) {
+Memory* global_var_code(GlobalVarNode var_node) {
     Memory* m = (Memory*) malloc(sizeof(Memory));
     m->id = var_node.identifier;
     m->base_reg = "rbss";
     m->offset = global_offset;
+    number_memory(m, var_node.storage);
     m->next = global_memory;
     global_memory = m;
     global_offset += 4;
+    return m;
 }
 
-void local_var_code(LocalVarNode var_node) {
+// The initializer still sees whatever the name referred to before
+void local_var_code(Node* node) {
+    LocalVarNode var_node = node->value->local_var_node;
+    generate_code(var_node.init);
+    Memory* mem = local_memory(node);
+    number_memory(mem, var_node.storage);
+    if (var_node.init)
+        init_code(mem, var_node.identifier);
+}
+
+Memory* local_memory(Node* decl) {
     Memory* mem = (Memory*) malloc(sizeof(Memory));
-    mem->id = var_node.identifier;
+    mem->id = decl->value->local_var_node.identifier;
     mem->base_reg = "rfp";
-    mem->offset = local_offset;
+    forget_name(mem->id);
+    mem->offset = map_get(&frame_slots, decl);
+    if (mem->offset < 0) {
+        // Not in a function laid out
+        mem->offset = local_offset;
+        local_offset += slot_size(decl->value->local_var_node.type, NULL);
+    }
+    mem->storage = 0;
     mem->next = global_memory;
     global_memory = mem;
-    local_offset += 4;
+    return mem;
+}
 
-    if (var_node.init) {
-        generate_code(var_node.init);
-        printf("storeAI r%d => rfp, %d", reg_counter, mem->offset);
-        printf(" // int %s = r%d\n", var_node.identifier, reg_counter);
-    }
+void init_code(Memory* mem, Atom id) {
+    fprintf(out(), "storeAI r%d => rfp, %d", reg_counter, mem->offset);
+    fprintf(out(), " // int %s = r%d\n", id, reg_counter);
+    forget_values(id);
 }
 
 void attr_code(AttrNode attr_node) {
     generate_code(attr_node.value);
-    Memory* mem = find_memory(attr_node.var->identifier);
-    printf("storeAI r%d => %s, %d", reg_counter, mem->base_reg, mem->offset);
-    printf(" // %s = r%d\n", attr_node.var->identifier, reg_counter);
+    store_code(variable_memory(attr_node.var), attr_node.var->identifier);
+}
+
+void store_code(Memory* mem, Atom id) {
+    fprintf(out(), "storeAI r%d => %s, %d", reg_counter, mem->base_reg, mem->offset);
+    fprintf(out(), " // %s = r%d\n", id, reg_counter);
+    forget_values(id);
 }
 
 void int_code(int int_node) {
-    printf("loadI %d => r%d\n", int_node, new_reg());
-} 
+    fprintf(out(), "loadI %d => r%d\n", int_node, new_reg());
+}
 
-void var_access_code(VariableNode var_node) {
-    Memory* mem = find_memory(var_node.identifier);
-    printf("loadAI %s, %d => r%d", mem->base_reg, mem->offset, new_reg());
-    printf(" // r%d = %s\n", reg_counter, var_node.identifier);
+void var_access_code(Node* node, Memory* mem) {
+    fprintf(out(), "loadAI %s, %d => r%d", mem->base_reg, mem->offset, new_reg());
+    fprintf(out(), " // r%d = %s\n", reg_counter, node->value->var_node.identifier);
+    if (node->shared)
+        remember_value(node);
 }
 
-void bin_op_code(BinOpNode node) {
-    switch(node.type) {
-    case AND:
-    case OR:
-        logic_expression(node);
-        break;
-    case GREATER:
-    case LESS_THAN:
-    case GREATER_EQUAL:
-    case LESS_EQUAL:
-    case EQUAL:
-    case NOT_EQUAL:
-        relational_expression(node);
-        break;
-    case ADD:
-    case SUBTRACT:
-    case MULTIPLY:
-    case DIVIDE:
-        arithmetic_expression(node);
-        break;
-    default:
-        break;
+bool continues_chain(Node* node, size_t depth) {
+    if (node->type != BIN_OP || !op_has_code(node->value->bin_op_node.type))
+        return false;
+    // An operand already computed is left for generate_code to copy
+    return depth == 0 || !node->shared || find_value(node) == NULL;
+}
+
+// Goes down the left operands with a stack, then back up generating each
+// operator with its left operand's result in reg_counter
+void bin_op_code(Node* node) {
+    NodeStack spine = {0};
+    while (continues_chain(node, spine.count)) {
+        enter_bin_op(node->value->bin_op_node.type);
+        push_node(&spine, node);
+        node = node->value->bin_op_node.left;
+    }
+    if (spine.count == 0)
+        return;
+    generate_code(node);
+
+    while (spine.count > 0) {
+        Node* op = pop_node(&spine);
+        BinOpCode code = begin_bin_op(op->value->bin_op_node.type);
+        generate_code(op->value->bin_op_node.right);
+        end_bin_op(op, code);
     }
+    free_stack(&spine);
 }
 
-void un_op_code(UnOpNode node) {
-    generate_code(node.value);
-    if (node.type == NOT) {
-        int label_true = new_label();
-        int label_false = new_label();
-        int label_end = new_label();
-        printf("cbr r%d -> L%d, L%d // NOT\n", reg_counter, label_true, label_false);
-        printf("L%d: cmp_NE r%d, r%d -> r%d\n", label_true, reg_counter, reg_counter, reg_counter);
-        printf("jumpI -> L%d\n", label_end);
-        printf("L%d: cmp_EQ r%d, r%d -> r%d\n", label_false, reg_counter, reg_counter, reg_counter);
-        printf("L%d: // END NOT\n", label_end);
-    } else if (node.type == MINUS) {
-        int expression_reg = reg_counter;
-        int result_reg = new_reg();
-        printf("rsubI r%d, 0 => r%d", expression_reg, result_reg);
-        printf(" // r%d = 0 - r%d\n", result_reg, expression_reg);
+void enter_bin_op(BinOpType type) {
+    if (type == AND || type == OR)
+        fprintf(out(), "// %s\n", type == AND ? "AND" : "OR");
+}
+
+BinOpCode begin_bin_op(BinOpType type) {
+    BinOpCode code;
+    code.type = type;
+    code.left_reg = reg_counter;
+    if (type == AND || type == OR) {
+        code.eval_right = new_label();
+        code.skip_right = new_label();
+        if (type == AND)
+            fprintf(out(), "cbr r%d -> L%d, L%d", code.left_reg, code.eval_right, code.skip_right);
+        else
+            fprintf(out(), "cbr r%d -> L%d, L%d", code.left_reg, code.skip_right, code.eval_right);
+        fprintf(out(), " // Depending on result, skip right eval (short circuit)\n");
+        fprintf(out(), "L%d: nop\n", code.eval_right);
+        start_block();
     }
+    return code;
 }
 
-void logic_expression(BinOpNode node) {
+static void logic_expression(BinOpCode code) {
     char op[4];
-    strcpy(op, node.type == AND ? "AND" : "OR");
-    printf("// %s\n", op);
-    generate_code(node.left);
-    int result_reg = reg_counter;
-    int eval_right = new_label();
-    int skip_right = new_label();
-    if (node.type == AND)
-        printf("cbr r%d -> L%d, L%d", result_reg, eval_right, skip_right);
-    else
-        printf("cbr r%d -> L%d, L%d", result_reg, skip_right, eval_right);
-    printf(" // Depending on result, skip right eval (short circuit)\n");
-    printf("L%d: nop\n", eval_right);
-    generate_code(node.right);
-    printf("i2i r%d => r%d", reg_counter, result_reg);
-    printf (" // Move right eval to result reg (r%d)\n", result_reg);
-    printf("L%d: nop\n", skip_right);
-    printf("i2i r%d => r%d", result_reg, new_reg());
-    printf(" // Move %s result to r%d\n", op, reg_counter);
-}
-
-void relational_expression(BinOpNode node) {
-    generate_code(node.left);
-    int left_result = reg_counter;
-    generate_code(node.right);
+    strcpy(op, code.type == AND ? "AND" : "OR");
+    int result_reg = code.left_reg;
+    fprintf(out(), "i2i r%d => r%d", reg_counter, result_reg);
+    fprintf(out(), " // Move right eval to result reg (r%d)\n", result_reg);
+    fprintf(out(), "L%d: nop\n", code.skip_right);
+    start_block();
+    fprintf(out(), "i2i r%d => r%d", result_reg, new_reg());
+    fprintf(out(), " // Move %s result to r%d\n", op, reg_counter);
+}
+
+static void relational_expression(BinOpCode code) {
+    int left_result = code.left_reg;
     int right_result = reg_counter;
     int cmp_result = new_reg();
 
     char op[3];
-    switch(node.type) {
+    switch(code.type) {
         case GREATER: strcpy(op, "GT"); break;
         case LESS_THAN: strcpy(op, "LT"); break;
         case GREATER_EQUAL: strcpy(op, "GE"); break;
@@ -182,19 +752,17 @@ void relational_expression(BinOpNode node) {
         case NOT_EQUAL: strcpy(op, "NE"); break;
         default: break;
     }
-    printf("cmp_%s r%d, r%d -> r%d", op, left_result, right_result, cmp_result);
-    printf(" // r%d = r%d %s r%d\n", cmp_result, left_result, op, right_result);
+    fprintf(out(), "cmp_%s r%d, r%d -> r%d", op, left_result, right_result, cmp_result);
+    fprintf(out(), " // r%d = r%d %s r%d\n", cmp_result, left_result, op, right_result);
 }
 
-void arithmetic_expression(BinOpNode node) {
-    generate_code(node.left);
-    int left_result = reg_counter;
-    generate_code(node.right);
+static void arithmetic_expression(BinOpCode code) {
+    int left_result = code.left_reg;
     int right_result = reg_counter;
     int result_reg = new_reg();
 
     char op[5];
-    switch(node.type) {
+    switch(code.type) {
         case ADD: strcpy(op, "add"); break;
         case SUBTRACT: strcpy(op, "sub"); break;
         case MULTIPLY: strcpy(op, "mult"); break;
@@ -202,60 +770,165 @@ void arithmetic_expression(BinOpNode node) {
         default: break;
     }
 
-    printf("%s r%d, r%d => r%d", op, left_result, right_result, result_reg);
-    printf(" // r%d = r%d %s r%d\n", result_reg, left_result, op, right_result);
+    fprintf(out(), "%s r%d, r%d => r%d", op, left_result, right_result, result_reg);
+    fprintf(out(), " // r%d = r%d %s r%d\n", result_reg, left_result, op, right_result);
+}
+
+void end_bin_op(Node* node, BinOpCode code) {
+    switch(code.type) {
+    case AND:
+    case OR:
+        logic_expression(code);
+        break;
+    case GREATER:
+    case LESS_THAN:
+    case GREATER_EQUAL:
+    case LESS_EQUAL:
+    case EQUAL:
+    case NOT_EQUAL:
+        relational_expression(code);
+        break;
+    default:
+        arithmetic_expression(code);
+        break;
+    }
+    if (node->shared)
+        remember_value(node);
+}
+
+void un_op_code(Node* node) {
+    generate_code(node->value->un_op_node.value);
+    end_un_op(node);
+}
+
+void end_un_op(Node* node) {
+    UnOpType type = node->value->un_op_node.type;
+    if (type == NOT) {
+        int label_true = new_label();
+        int label_false = new_label();
+        int label_end = new_label();
+        fprintf(out(), "cbr r%d -> L%d, L%d // NOT\n", reg_counter, label_true, label_false);
+        fprintf(out(), "L%d: cmp_NE r%d, r%d -> r%d\n", label_true, reg_counter, reg_counter, reg_counter);
+        fprintf(out(), "jumpI -> L%d\n", label_end);
+        fprintf(out(), "L%d: cmp_EQ r%d, r%d -> r%d\n", label_false, reg_counter, reg_counter, reg_counter);
+        fprintf(out(), "L%d: // END NOT\n", label_end);
+        start_block();
+    } else if (type == MINUS) {
+        int expression_reg = reg_counter;
+        int result_reg = new_reg();
+        fprintf(out(), "rsubI r%d, 0 => r%d", expression_reg, result_reg);
+        fprintf(out(), " // r%d = 0 - r%d\n", result_reg, expression_reg);
+    } else
+        return;
+    if (node->shared)
+        remember_value(node);
 }
 
 void if_code(IfNode if_node) {
-    printf("// IF\n");
+    begin_if();
     generate_code(if_node.cond);
-    int result_reg = reg_counter;
-    int then_label = new_label();
-    int else_label = new_label();
-    int endif_label = new_label();
-    printf("cbr r%d -> L%d, L%d", result_reg, then_label, else_label);
-    printf(" // If result (r%d) is false, goto else (L%d)\n", result_reg, else_label);
-    printf("L%d: nop // THEN\n", then_label);
+    IfLabels labels = then_code();
     generate_code(if_node.then);
-    printf("jumpI -> L%d // goto ENDIF\n", endif_label);
-    printf("L%d: nop // ELSE\n", else_label);
+    else_code(labels);
     generate_code(if_node.else_node);
-    printf("L%d: nop\n// ENDIF\n", endif_label);
+    end_if(labels);
+}
+
+void begin_if() {
+    fprintf(out(), "// IF\n");
+}
+
+IfLabels then_code() {
+    IfLabels labels;
+    int result_reg = reg_counter;
+    labels.then_label = new_label();
+    labels.else_label = new_label();
+    labels.endif_label = new_label();
+    fprintf(out(), "cbr r%d -> L%d, L%d", result_reg, labels.then_label, labels.else_label);
+    fprintf(out(), " // If result (r%d) is false, goto else (L%d)\n", result_reg, labels.else_label);
+    fprintf(out(), "L%d: nop // THEN\n", labels.then_label);
+    start_block();
+    return labels;
+}
+
+void else_code(IfLabels labels) {
+    fprintf(out(), "jumpI -> L%d // goto ENDIF\n", labels.endif_label);
+    fprintf(out(), "L%d: nop // ELSE\n", labels.else_label);
+    start_block();
+}
+
+void end_if(IfLabels labels) {
+    fprintf(out(), "L%d: nop\n// ENDIF\n", labels.endif_label);
+    start_block();
 }
 
 void while_code(WhileNode while_node) {
-    printf("// WHILE\n");
-    int test_label = new_label();
-    printf("L%d: nop // TEST\n", test_label);
+    int test_label = begin_while();
     generate_code(while_node.cond);
+    WhileLabels labels = while_body_code(test_label);
+    generate_code(while_node.body);
+    end_while(labels);
+}
+
+int begin_while() {
+    fprintf(out(), "// WHILE\n");
+    int test_label = new_label();
+    fprintf(out(), "L%d: nop // TEST\n", test_label);
+    start_block();
+    return test_label;
+}
+
+WhileLabels while_body_code(int test_label) {
+    WhileLabels labels;
+    labels.test_label = test_label;
     int test_result = reg_counter;
     int enter_label = new_label();
-    int leave_label = new_label();
-    printf("cbr r%d -> L%d, L%d", test_result, enter_label, leave_label);
-    printf(" // If test result (r%d) is false, leave while(L%d)\n", test_result, leave_label);
-    printf("L%d: nop // ENTER WHILE\n", enter_label);
-    generate_code(while_node.body);
-    printf("jumpI -> L%d // goto TEST\n", test_label);
-    printf("L%d: nop // LEAVE WHILE\n", leave_label);
+    labels.leave_label = new_label();
+    fprintf(out(), "cbr r%d -> L%d, L%d", test_result, enter_label, labels.leave_label);
+    fprintf(out(), " // If test result (r%d) is false, leave while(L%d)\n", test_result, labels.leave_label);
+    fprintf(out(), "L%d: nop // ENTER WHILE\n", enter_label);
+    start_block();
+    return labels;
+}
+
+void end_while(WhileLabels labels) {
+    fprintf(out(), "jumpI -> L%d // goto TEST\n", labels.test_label);
+    fprintf(out(), "L%d: nop // LEAVE WHILE\n", labels.leave_label);
+    start_block();
 }
 
 void do_while_code(WhileNode do_while_node) {
-    int enter_label = new_label();
-    printf("L%d: nop // ENTER DO WHILE\n", enter_label);
+    int enter_label = begin_do_while();
     generate_code(do_while_node.body);
-    printf("// TEST\n");
+    do_while_test_code();
     generate_code(do_while_node.cond);
+    end_do_while(enter_label);
+}
+
+int begin_do_while() {
+    int enter_label = new_label();
+    fprintf(out(), "L%d: nop // ENTER DO WHILE\n", enter_label);
+    start_block();
+    return enter_label;
+}
+
+void do_while_test_code() {
+    fprintf(out(), "// TEST\n");
+}
+
+void end_do_while(int enter_label) {
     int test_result = reg_counter;
     int leave_label = new_label();
-    printf("cbr r%d -> L%d, L%d", test_result, enter_label, leave_label);
-    printf(" // If test result (r%d) is true, enter do while(L%d)\n", test_result, enter_label);
-    printf("L%d: nop // LEAVE DO WHILE\n", leave_label);
+    fprintf(out(), "cbr r%d -> L%d, L%d", test_result, enter_label, leave_label);
+    fprintf(out(), " // If test result (r%d) is true, enter do while(L%d)\n", test_result, enter_label);
+    fprintf(out(), "L%d: nop // LEAVE DO WHILE\n", leave_label);
+    start_block();
 }
 
-Memory* find_memory(char* id) {
+Memory* find_memory(Atom id) {
     Memory* mem = global_memory;
     while (mem != NULL) {
-        if (strcmp(mem->id, id) == 0) {
+        if (mem->id == id) {
             break;
         }
         mem = mem->next;
@@ -263,6 +936,14 @@ Memory* find_memory(char* id) {
     return mem;
 }
 
+// Variables not numbered, like those of trees never checked, are still
+// looked up by name
+Memory* variable_memory(VariableNode* var) {
+    if (var->storage != 0 && var->storage < numbered_capacity && numbered[var->storage] != NULL)
+        return numbered[var->storage];
+    return find_memory(var->identifier);
+}
+
 int new_reg() {
     reg_counter++;
     return reg_counter;
@@ -1,29 +1,104 @@
 #include "table.h"
 
 typedef struct memory {
-    char* id;
+    Atom id;
     char* base_reg;
     int offset;
+    // The number the checker gave it, see GlobalVarNode
+    uint32_t storage;
     struct memory* next;
 } Memory;
 
+// Where the code goes, stdout if NULL
+extern FILE* code_output;
+
 void generate_code(Node* node);
-void global_var_code(GlobalVarNode var_node);
-void local_var_code(LocalVarNode var_node);
+void generate_declaration(Node* node);
+Memory* global_var_code(GlobalVarNode var_node);
+void local_var_code(Node* node);
 void attr_code(AttrNode attr_node);
 void int_code(int int_node);
-void var_access_code(VariableNode var_node);
+void var_access_code(Node* node, Memory* mem);
 
-void un_op_code(UnOpNode node);
-void bin_op_code(BinOpNode node);
-void logic_expression(BinOpNode node);
-void relational_expression(BinOpNode node);
-void arithmetic_expression(BinOpNode node);
+void un_op_code(Node* node);
+void bin_op_code(Node* node);
 
 void if_code(IfNode if_node);
 void while_code(WhileNode while_node);
 void do_while_code(WhileNode do_while_node);
 
-Memory* find_memory(char* id);
+// The pieces the code of each construct is made of, in the order they are
+// emitted: compile_program emits each as soon as what it follows is
+// checked, and the functions above put them together the same way.
+
+// Whether the node, or anything in it, has code
+bool has_code(Node* node);
+// Copies the value of a shared node to a new register if it is computed
+// already in the current basic block
+bool reuse_value(Node* node);
+// A declaration hides the name: the values read through it are forgotten,
+// with or without an initializer
+void forget_name(Atom id);
+
+// Lays out the frame of the function: locals that do not live at the same
+// time share their slot. The table gives the size of classes, or NULL for
+// the sizes found by the last check. Locals are forgotten at the end.
+Memory* begin_function(Node* function, SymbolsTable* table);
+void end_function(Memory* outer);
+Memory* local_memory(Node* decl);
+// Stores reg_counter in a local as it is declared, or on assignment
+void init_code(Memory* mem, Atom id);
+void store_code(Memory* mem, Atom id);
+
+// Whether bin_op_code takes `node`, `depth` operators down the left
+// operands, as one more operator of the chain it generates
+bool continues_chain(Node* node, size_t depth);
+
+typedef struct {
+    BinOpType type;
+    int left_reg;
+    int eval_right; // Labels of AND and OR
+    int skip_right;
+} BinOpCode;
+
+// On the way down the chain, before any operand
+void enter_bin_op(BinOpType type);
+// Around the code of the right operand, with the left one's in reg_counter
+BinOpCode begin_bin_op(BinOpType type);
+void end_bin_op(Node* node, BinOpCode code);
+
+// After the code of the operand
+void end_un_op(Node* node);
+
+typedef struct {
+    int then_label;
+    int else_label;
+    int endif_label;
+} IfLabels;
+
+// Before the condition, after it, after the then block and at the end
+void begin_if();
+IfLabels then_code();
+void else_code(IfLabels labels);
+void end_if(IfLabels labels);
+
+typedef struct {
+    int test_label;
+    int leave_label;
+} WhileLabels;
+
+// Before the condition, after it and after the body
+int begin_while();
+WhileLabels while_body_code(int test_label);
+void end_while(WhileLabels labels);
+
+// Before the body, after it and after the condition
+int begin_do_while();
+void do_while_test_code();
+void end_do_while(int enter_label);
+
+Memory* find_memory(Atom id);
+// Where the variable is, by the number of its storage when it has one
+Memory* variable_memory(VariableNode* var);
 int new_reg();
-int new_label();
\ No newline at end of file
+int new_label();
@@ -0,0 +1,127 @@
+#include "intern.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 1024
+#define CACHE_SIZE 4096
+
+typedef struct AtomEntry {
+  size_t length;
+  uint32_t hash;
+  char text[];
+} AtomEntry;
+
+// Open addressing with linear probing; capacity is always a power of two
+static AtomEntry** slots = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+static bool registered = false;
+// Shared by every compilation running in the process
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Bumped by intern_clear, which invalidates every cached atom
+static unsigned generation = 1;
+
+// Per-thread cache in front of the table, so threads lexing in parallel
+// rarely contend on the lock
+static __thread AtomEntry* cache[CACHE_SIZE];
+static __thread unsigned cache_generation = 0;
+
+static uint32_t hash_bytes(const char* str, size_t len) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) str[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void grow() {
+  size_t new_capacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+  AtomEntry** new_slots = calloc(new_capacity, sizeof(AtomEntry*));
+  for (size_t i = 0; i < capacity; i++) {
+    AtomEntry* e = slots[i];
+    if (e == NULL)
+      continue;
+    size_t j = e->hash & (new_capacity - 1);
+    while (new_slots[j] != NULL)
+      j = (j + 1) & (new_capacity - 1);
+    new_slots[j] = e;
+  }
+  if (!registered) {
+    atexit(intern_clear);
+    registered = true;
+  }
+  free(slots);
+  slots = new_slots;
+  capacity = new_capacity;
+}
+
+Atom intern(const char* str, size_t len) {
+  uint32_t h = hash_bytes(str, len);
+
+  unsigned current = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+  if (cache_generation != current) {
+    memset(cache, 0, sizeof(cache));
+    cache_generation = current;
+  }
+  AtomEntry** cached = &cache[h & (CACHE_SIZE - 1)];
+  if (*cached != NULL && (*cached)->hash == h && (*cached)->length == len &&
+      memcmp((*cached)->text, str, len) == 0)
+    return (*cached)->text;
+
+  pthread_mutex_lock(&lock);
+  if (2 * (count + 1) > capacity)
+    grow();
+
+  size_t i = h & (capacity - 1);
+  while (slots[i] != NULL) {
+    AtomEntry* e = slots[i];
+    if (e->hash == h && e->length == len && memcmp(e->text, str, len) == 0) {
+      pthread_mutex_unlock(&lock);
+      *cached = e;
+      return e->text;
+    }
+    i = (i + 1) & (capacity - 1);
+  }
+
+  AtomEntry* e = malloc(sizeof(AtomEntry) + len + 1);
+  e->length = len;
+  e->hash = h;
+  memcpy(e->text, str, len);
+  e->text[len] = '\0';
+  slots[i] = e;
+  count++;
+  pthread_mutex_unlock(&lock);
+  *cached = e;
+  return e->text;
+}
+
+Atom intern_str(const char* str) {
+  return intern(str, strlen(str));
+}
+
+size_t atom_length(Atom atom) {
+  const AtomEntry* e = (const AtomEntry*) (atom - offsetof(AtomEntry, text));
+  return e->length;
+}
+
+uint32_t atom_hash(Atom atom) {
+  const AtomEntry* e = (const AtomEntry*) (atom - offsetof(AtomEntry, text));
+  return e->hash;
+}
+
+void intern_clear() {
+  pthread_mutex_lock(&lock);
+  for (size_t i = 0; i < capacity; i++)
+    free(slots[i]);
+  free(slots);
+  slots = NULL;
+  capacity = 0;
+  count = 0;
+  __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,22 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Interned names: every distinct identifier (or string literal) maps to a
+// single stable pointer, so two atoms are equal iff the pointers are equal.
+// Atoms are owned by the intern table and must never be freed.
+typedef const char* Atom;
+
+Atom intern(const char* str, size_t len);
+Atom intern_str(const char* str);
+
+// Byte length of an atom (without the terminating NUL)
+size_t atom_length(Atom atom);
+// Hash of the text of an atom, the same in every run unlike its address
+uint32_t atom_hash(Atom atom);
+
+void intern_clear();
+
+#endif
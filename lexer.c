@@ -0,0 +1,542 @@
+// Hand-written lexer, an alternative to the flex scanner in scanner.l.
+// Whitespace, identifiers, comments and string literals are classified a
+// whole block of bytes at a time (32 bytes with AVX2, 16 with SSE2). It
+// produces exactly the same tokens, values and positions as scanner.l and
+// exposes the same reentrant flex API (see lexer.h).
+
+#include "lexer.h"
+#include "source.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Block classification
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#define BLOCK_SIZE 32
+typedef __m256i Block;
+#define block_load(p) _mm256_loadu_si256((const __m256i*) (p))
+#define block_set(c) _mm256_set1_epi8(c)
+#define block_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define block_or(a, b) _mm256_or_si256(a, b)
+#define block_sub(a, b) _mm256_sub_epi8(a, b)
+#define block_min(a, b) _mm256_min_epu8(a, b)
+#define block_mask(a) ((uint32_t) _mm256_movemask_epi8(a))
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+#define BLOCK_SIZE 16
+typedef __m128i Block;
+#define block_load(p) _mm_loadu_si128((const __m128i*) (p))
+#define block_set(c) _mm_set1_epi8(c)
+#define block_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define block_or(a, b) _mm_or_si128(a, b)
+#define block_sub(a, b) _mm_sub_epi8(a, b)
+#define block_min(a, b) _mm_min_epu8(a, b)
+#define block_mask(a) ((uint32_t) _mm_movemask_epi8(a))
+
+#else
+
+#define BLOCK_SIZE 8
+
+#endif
+
+#define FULL_MASK ((uint32_t) ((1ull << BLOCK_SIZE) - 1))
+
+#ifdef block_load
+
+// Bytes equal to c
+static inline uint32_t byte_mask(const char* p, char c) {
+  return block_mask(block_eq(block_load(p), block_set(c)));
+}
+
+// Bytes in [lo, lo + n], using unsigned wrap-around: x - lo <= n
+static inline Block in_range(Block x, char lo, char n) {
+  Block t = block_sub(x, block_set(lo));
+  return block_eq(block_min(t, block_set(n)), t);
+}
+
+static inline uint32_t space_mask(const char* p) {
+  Block x = block_load(p);
+  Block space = block_or(block_eq(x, block_set(' ')), block_eq(x, block_set('\t')));
+  return block_mask(block_or(space, block_eq(x, block_set('\n'))));
+}
+
+// [A-Za-z0-9_]
+static inline uint32_t ident_mask(const char* p) {
+  Block x = block_load(p);
+  Block alpha = in_range(block_or(x, block_set(0x20)), 'a', 'z' - 'a');
+  Block digit = in_range(x, '0', '9' - '0');
+  return block_mask(block_or(block_or(alpha, digit), block_eq(x, block_set('_'))));
+}
+
+#else
+
+static inline uint32_t byte_mask(const char* p, char c) {
+  uint32_t mask = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++)
+    mask |= (uint32_t) (p[i] == c) << i;
+  return mask;
+}
+
+static inline uint32_t space_mask(const char* p) {
+  uint32_t mask = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++)
+    mask |= (uint32_t) (p[i] == ' ' || p[i] == '\t' || p[i] == '\n') << i;
+  return mask;
+}
+
+static inline uint32_t ident_mask(const char* p) {
+  uint32_t mask = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    char c = p[i];
+    bool ident = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                 (c >= '0' && c <= '9') || c == '_';
+    mask |= (uint32_t) ident << i;
+  }
+  return mask;
+}
+
+#endif
+
+// Every scan below may load a whole block past `end`; buffers are always
+// followed by SOURCE_PADDING zero bytes, which belong to no class.
+
+// Skips [ \t\n]*
+static const char* skip_space(const char* p, const char* end) {
+  while (p < end) {
+    uint32_t rest = ~space_mask(p) & FULL_MASK;
+    if (rest)
+      return p + __builtin_ctz(rest) < end ? p + __builtin_ctz(rest) : end;
+    p += BLOCK_SIZE;
+  }
+  return end;
+}
+
+static const char* skip_ident(const char* p, const char* end) {
+  while (p < end) {
+    uint32_t rest = ~ident_mask(p) & FULL_MASK;
+    if (rest)
+      return p + __builtin_ctz(rest) < end ? p + __builtin_ctz(rest) : end;
+    p += BLOCK_SIZE;
+  }
+  return end;
+}
+
+// First occurrence of a or b, or end
+static const char* find_either(const char* p, const char* end, char a, char b) {
+  while (p < end) {
+    uint32_t found = byte_mask(p, a) | byte_mask(p, b);
+    if (found)
+      return p + __builtin_ctz(found) < end ? p + __builtin_ctz(found) : end;
+    p += BLOCK_SIZE;
+  }
+  return end;
+}
+
+// Position of the next "*/", or end
+static const char* find_comment_end(const char* p, const char* end) {
+  while (p < end) {
+    uint32_t found = byte_mask(p, '*') & byte_mask(p + 1, '/');
+    if (found)
+      return p + __builtin_ctz(found) < end ? p + __builtin_ctz(found) : end;
+    p += BLOCK_SIZE;
+  }
+  return end;
+}
+
+// Lexer state
+
+typedef struct LexerBuffer {
+  char* base;
+  char* end;
+  char* pos;
+  bool owned;
+  struct LexerBuffer* next;
+} LexerBuffer;
+
+typedef struct Lexer {
+  ParseContext* extra;
+  LexerBuffer* current;
+  LexerBuffer* buffers;
+  bool in_comment;
+
+  // yytext is NUL terminated in place; the byte it replaced is kept here
+  char* text;
+  int leng;
+  char* hold_pos;
+  char hold_char;
+} Lexer;
+
+static char empty_text[1] = "";
+
+static void restore_hold(Lexer* lexer) {
+  if (lexer->hold_pos != NULL) {
+    *lexer->hold_pos = lexer->hold_char;
+    lexer->hold_pos = NULL;
+  }
+}
+
+static LexerBuffer* add_buffer(Lexer* lexer, char* base, size_t size, bool owned) {
+  restore_hold(lexer);
+  LexerBuffer* b = malloc(sizeof(LexerBuffer));
+  b->base = base;
+  b->end = base + size;
+  b->pos = base;
+  b->owned = owned;
+  b->next = lexer->buffers;
+  lexer->buffers = b;
+  lexer->current = b;
+  return b;
+}
+
+YY_BUFFER_STATE yy_scan_bytes(const char* bytes, int len, yyscan_t scanner) {
+  char* base = calloc(len + SOURCE_PADDING, 1);
+  memcpy(base, bytes, len);
+  return add_buffer(scanner, base, len, true);
+}
+
+YY_BUFFER_STATE yy_scan_string(const char* str, yyscan_t scanner) {
+  return yy_scan_bytes(str, strlen(str), scanner);
+}
+
+// Scans `base` in place. As in flex, `size` counts two terminating NULs,
+// and the buffer must also be followed by SOURCE_PADDING zero bytes.
+YY_BUFFER_STATE yy_scan_buffer(char* base, size_t size, yyscan_t scanner) {
+  return add_buffer(scanner, base, size - 2, false);
+}
+
+void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner) {
+  Lexer* lexer = scanner;
+  if (buffer == NULL)
+    return;
+  if (lexer->current == buffer) {
+    restore_hold(lexer);
+    lexer->current = NULL;
+  }
+  LexerBuffer** link = &lexer->buffers;
+  while (*link != buffer)
+    link = &(*link)->next;
+  *link = buffer->next;
+  if (buffer->owned)
+    free(buffer->base);
+  free(buffer);
+}
+
+// Same default as flex: with no buffer, scan the whole standard input
+static void scan_stdin(Lexer* lexer) {
+  Source source;
+  read_source(&source, stdin);
+  add_buffer(lexer, source.text, source.size, true);
+}
+
+int yylex_init_extra(ParseContext* extra, yyscan_t* scanner) {
+  Lexer* lexer = calloc(1, sizeof(Lexer));
+  lexer->extra = extra;
+  lexer->text = empty_text;
+  *scanner = lexer;
+  return 0;
+}
+
+int yylex_destroy(yyscan_t scanner) {
+  Lexer* lexer = scanner;
+  while (lexer->buffers != NULL)
+    yy_delete_buffer(lexer->buffers, lexer);
+  free(lexer);
+  return 0;
+}
+
+ParseContext* yyget_extra(yyscan_t scanner) {
+  return ((Lexer*) scanner)->extra;
+}
+
+char* yyget_text(yyscan_t scanner) {
+  return ((Lexer*) scanner)->text;
+}
+
+int yyget_leng(yyscan_t scanner) {
+  return ((Lexer*) scanner)->leng;
+}
+
+char* scanner_hold(yyscan_t scanner, char* hold_char) {
+  Lexer* lexer = scanner;
+  *hold_char = lexer->hold_char;
+  return lexer->hold_pos;
+}
+
+bool scanner_in_comment(yyscan_t scanner) {
+  return ((Lexer*) scanner)->in_comment;
+}
+
+void scanner_set_comment(yyscan_t scanner, bool in_comment) {
+  ((Lexer*) scanner)->in_comment = in_comment;
+}
+
+// Consumes a token and makes it the NUL terminated yytext. As in scanner.l,
+// tokens only record the offset where they start.
+static void begin_token(Lexer* lexer, YYSTYPE* lval, char* start, int len) {
+  ParseContext* context = lexer->extra;
+  lval->token.offset = context->scan_offset;
+  context->scan_offset += len;
+  lexer->text = start;
+  lexer->leng = len;
+  lexer->hold_pos = start + len;
+  lexer->hold_char = start[len];
+  start[len] = '\0';
+  lexer->current->pos = start + len;
+}
+
+// Keywords
+
+typedef struct Keyword {
+  const char* text;
+  int token;
+} Keyword;
+
+static const Keyword keywords[] = {
+  { "int", TK_PR_INT }, { "float", TK_PR_FLOAT }, { "bool", TK_PR_BOOL },
+  { "char", TK_PR_CHAR }, { "string", TK_PR_STRING }, { "if", TK_PR_IF },
+  { "then", TK_PR_THEN }, { "else", TK_PR_ELSE }, { "while", TK_PR_WHILE },
+  { "do", TK_PR_DO }, { "input", TK_PR_INPUT }, { "output", TK_PR_OUTPUT },
+  { "return", TK_PR_RETURN }, { "const", TK_PR_CONST }, { "static", TK_PR_STATIC },
+  { "foreach", TK_PR_FOREACH }, { "for", TK_PR_FOR }, { "switch", TK_PR_SWITCH },
+  { "case", TK_PR_CASE }, { "break", TK_PR_BREAK }, { "continue", TK_PR_CONTINUE },
+  { "class", TK_PR_CLASS }, { "private", TK_PR_PRIVATE }, { "public", TK_PR_PUBLIC },
+  { "protected", TK_PR_PROTECTED }, { "true", TK_LIT_TRUE }, { "false", TK_LIT_FALSE },
+  { NULL, 0 }
+};
+
+static int find_keyword(const char* text, int len) {
+  // Keywords are 2 to 9 bytes long and all start with a lowercase letter
+  if (len < 2 || len > 9 || text[0] < 'a' || text[0] > 'z')
+    return 0;
+  for (const Keyword* k = keywords; k->text != NULL; k++)
+    if (k->text[0] == text[0] && strncmp(k->text, text, len) == 0 && k->text[len] == '\0')
+      return k->token;
+  return 0;
+}
+
+static void keyword_value(int token, YYSTYPE* lval) {
+  switch (token) {
+    case TK_PR_INT:
+    case TK_PR_FLOAT:
+    case TK_PR_BOOL:
+    case TK_PR_CHAR:
+    case TK_PR_STRING:
+      lval->token.category = TYPE_KEYWORD;
+      lval->token.value.type_keyword =
+        token == TK_PR_INT ? INT_T :
+        token == TK_PR_FLOAT ? FLOAT_T :
+        token == TK_PR_BOOL ? BOOL_T :
+        token == TK_PR_CHAR ? CHAR_T : STRING_T;
+      break;
+    case TK_PR_PRIVATE:
+      lval->token.category = SCOPE_KEYWORD;
+      lval->token.value.scope = PRIVATE;
+      break;
+    case TK_PR_PUBLIC:
+      lval->token.category = SCOPE_KEYWORD;
+      lval->token.value.scope = PUBLIC;
+      break;
+    case TK_PR_PROTECTED:
+      lval->token.category = SCOPE_KEYWORD;
+      lval->token.value.scope = PROTECTED;
+      break;
+    case TK_LIT_TRUE:
+    case TK_LIT_FALSE:
+      lval->token.category = BOOL_LITERAL;
+      lval->token.value.bool_literal = token == TK_LIT_TRUE;
+      break;
+  }
+}
+
+// Two and three character operators
+
+static int find_operator(const char* p, int* len, YYSTYPE* lval) {
+  BinOpType op;
+  int token;
+  *len = 2;
+  switch (p[0]) {
+    case '<':
+      if (p[1] == '=') { token = TK_OC_LE; op = LESS_EQUAL; break; }
+      if (p[1] == '<') return TK_OC_SL;
+      return 0;
+    case '>':
+      if (p[1] == '=') { token = TK_OC_GE; op = GREATER_EQUAL; break; }
+      if (p[1] == '>') return TK_OC_SR;
+      return 0;
+    case '=':
+      if (p[1] == '=') { token = TK_OC_EQ; op = EQUAL; break; }
+      return 0;
+    case '!':
+      if (p[1] == '=') { token = TK_OC_NE; op = NOT_EQUAL; break; }
+      return 0;
+    case '&':
+      if (p[1] == '&') { token = TK_OC_AND; op = AND; break; }
+      return 0;
+    case '|':
+      if (p[1] == '|') { token = TK_OC_OR; op = OR; break; }
+      return 0;
+    case '%':
+      *len = 3;
+      if (p[1] == '>' && p[2] == '%') { token = TK_OC_FORWARD_PIPE; op = FORWARD_PIPE; break; }
+      if (p[1] == '|' && p[2] == '%') { token = TK_OC_BASH_PIPE; op = BASH_PIPE; break; }
+      return 0;
+    default:
+      return 0;
+  }
+  lval->token.category = BINARY_OPERATOR;
+  lval->token.value.binary_operator = op;
+  return token;
+}
+
+static bool is_special(char c) {
+  return c != '\0' && strchr(",;:()[]{}+-|?*/<>=!&%#^.$", c) != NULL;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Length of {INT}, {FLOAT} starting at p; sets *is_float
+static int number_length(const char* p, const char* end, bool* is_float) {
+  const char* q = p;
+  while (q < end && is_digit(*q))
+    q++;
+  *is_float = false;
+  if (q + 1 < end && q[0] == '.' && is_digit(q[1])) {
+    *is_float = true;
+    q += 2;
+    while (q < end && is_digit(*q))
+      q++;
+    // The exponent only belongs to the literal if it has digits
+    const char* e = q;
+    if (e < end && (*e == 'e' || *e == 'E')) {
+      e++;
+      if (e < end && (*e == '+' || *e == '-'))
+        e++;
+      if (e < end && is_digit(*e)) {
+        while (e < end && is_digit(*e))
+          e++;
+        q = e;
+      }
+    }
+  }
+  return q - p;
+}
+
+int yylex(YYSTYPE* lval, yyscan_t scanner) {
+  Lexer* lexer = scanner;
+  restore_hold(lexer);
+  if (lexer->current == NULL)
+    scan_stdin(lexer);
+
+  LexerBuffer* b = lexer->current;
+  char* p = b->pos;
+  char* end = b->end;
+
+  // Whitespace and comments, consumed in bulk
+  char* start = p;
+  for (;;) {
+    char* before = p;
+    if (lexer->in_comment || (p + 1 < end && p[0] == '/' && p[1] == '*')) {
+      p = (char*) find_comment_end(lexer->in_comment ? p : p + 2, end);
+      lexer->in_comment = p == end;
+      if (p < end)
+        p += 2;
+    } else if (p < end && (*p == ' ' || *p == '\t' || *p == '\n'))
+      p = (char*) skip_space(p, end);
+    else if (p + 1 < end && p[0] == '/' && p[1] == '/')
+      p = (char*) find_either(p + 2, end, '\n', '\n');
+    else
+      break;
+    if (p == before)
+      break;
+  }
+  lexer->extra->scan_offset += p - start;
+  b->pos = p;
+
+  if (p >= end) {
+    lexer->text = empty_text;
+    lexer->leng = 0;
+    return 0;
+  }
+
+  char c = *p;
+
+  // Identifiers and keywords
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+    int len = skip_ident(p, end) - p;
+    int token = find_keyword(p, len);
+    begin_token(lexer, lval, p, len);
+    if (token != 0) {
+      keyword_value(token, lval);
+      return token;
+    }
+    lval->token.category = IDENTIFIER;
+    lval->token.value.identifier = intern(p, len);
+    return TK_IDENTIFICADOR;
+  }
+
+  // Numbers
+  if (is_digit(c)) {
+    bool is_float;
+    int len = number_length(p, end, &is_float);
+    begin_token(lexer, lval, p, len);
+    if (is_float) {
+      lval->token.category = FLOAT_LITERAL;
+      lval->token.value.float_literal = atof(p);
+      return TK_LIT_FLOAT;
+    }
+    lval->token.category = INT_LITERAL;
+    lval->token.value.int_literal = atoi(p);
+    return TK_LIT_INT;
+  }
+
+  // Character literals
+  if (c == '\'' && p + 2 < end && p[1] != '\n' && p[2] == '\'') {
+    begin_token(lexer, lval, p, 3);
+    lval->token.category = CHAR_LITERAL;
+    lval->token.value.char_literal = p[1];
+    return TK_LIT_CHAR;
+  }
+
+  // String literals
+  if (c == '"') {
+    char* close = (char*) find_either(p + 1, end, '"', '\n');
+    if (close < end && *close == '"') {
+      int len = close + 1 - p;
+      begin_token(lexer, lval, p, len);
+      lval->token.category = STRING_LITERAL;
+      ParseContext* context = lexer->extra;
+      if (context->buffer != NULL && b == context->buffer)
+        lval->token.value.string_literal.text = p + 1;
+      else
+        lval->token.value.string_literal.text = intern(p + 1, len - 2);
+      lval->token.value.string_literal.length = len - 2;
+      return TK_LIT_STRING;
+    }
+  }
+
+  // Operators and special characters
+  int len;
+  int token = find_operator(p, &len, lval);
+  if (token != 0) {
+    begin_token(lexer, lval, p, len);
+    return token;
+  }
+  if (is_special(c)) {
+    begin_token(lexer, lval, p, 1);
+    lval->token.category = SPECIAL_CHAR;
+    lval->token.value.special_char = c;
+    return c;
+  }
+
+  // Invalid characters never advanced the column, keep it that way
+  begin_token(lexer, lval, p, 1);
+  skip_column(&lexer->extra->source, lval->token.offset);
+  return TOKEN_ERRO;
+}
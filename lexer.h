@@ -0,0 +1,44 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+// Scanner interface used by the parser, the driver and the tests. The
+// backend is chosen at build time: the flex scanner generated from
+// scanner.l (default), or the hand-written SIMD lexer in lexer.c when
+// SIMD_LEXER is defined. Both expose the same reentrant flex API.
+
+#include "parser.tab.h"
+
+#ifndef SIMD_LEXER
+
+#include "lex.yy.h"
+
+#else
+
+typedef void* yyscan_t;
+typedef struct LexerBuffer* YY_BUFFER_STATE;
+
+int yylex_init_extra(ParseContext* extra, yyscan_t* scanner);
+int yylex_destroy(yyscan_t scanner);
+int yylex(YYSTYPE* lval, yyscan_t scanner);
+
+ParseContext* yyget_extra(yyscan_t scanner);
+char* yyget_text(yyscan_t scanner);
+int yyget_leng(yyscan_t scanner);
+
+YY_BUFFER_STATE yy_scan_string(const char* str, yyscan_t scanner);
+YY_BUFFER_STATE yy_scan_bytes(const char* bytes, int len, yyscan_t scanner);
+YY_BUFFER_STATE yy_scan_buffer(char* base, size_t size, yyscan_t scanner);
+void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+
+#endif
+
+// Both backends NUL terminate yytext in place. Returns where, and the byte
+// that was replaced, or NULL if nothing was scanned yet.
+char* scanner_hold(yyscan_t scanner, char* hold_char);
+
+// Whether the scanner is inside a block comment, which is the only state
+// that carries over from one line to the next
+bool scanner_in_comment(yyscan_t scanner);
+void scanner_set_comment(yyscan_t scanner, bool in_comment);
+
+#endif
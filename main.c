@@ -4,7 +4,7 @@ Função principal para realização da E3.
 Este arquivo não pode ser modificado.
 */
 #include <stdio.h>
-#include "lex.yy.h"
+#include "driver.h"
 #include "semantic.h"
 #include "iloc.h"
 #include "parser.tab.h" //arquivo gerado com bison -d parser.y
@@ -15,16 +15,21 @@ void libera (void *arvore);
 
 int main (int argc, char **argv)
 {
-  int ret = yyparse();
+  ParseContext context;
+  Driver driver;
+  if (start_driver(&driver, &context, argc, argv) != 0)
+    return 1;
+  int ret = parse_input(&driver);
+  arvore = context.tree;
   if (ret == 0) {
     //descompila (arvore);
-    ret = check_program(arvore);
+    ret = check_input(&driver, arvore);
   }
   if (ret == 0) {
-    generate_code(arvore);
+    generate_input(&driver, arvore);
   }
   libera(arvore);
   arvore = NULL;
-  yylex_destroy();
+  stop_driver(&driver);
   return ret;
 }
@@ -1,32 +1,125 @@
 %{
 #include <stdio.h>
 #include <stdbool.h>
-#include "lex.yy.h"
+%}
 
-int yylex(void);
-void yyerror (char const *s);
+%code requires {
+#include "tree.h"
+#include "source.h"
 
-extern void *arvore;
-bool invalid_input;
+// Sources at least this large are worth lexing in parallel with prelex
+#define PRELEX_MIN_SIZE (4 << 20)
 
-extern int get_line_number();
-extern int get_column_number();
-%}
+// A token lexed ahead of time, exactly as yylex returned it
+typedef struct LexedToken {
+  int type;
+  uint32_t end; // Offset just past the token
+  Token token;
+} LexedToken;
+
+// Lists under construction. Keeping the tail lets the list rules be left
+// recursive, so the parser stack does not grow with the length of a list.
+typedef struct NodeList { Node* head; Node* tail; } NodeList;
+typedef struct FieldList { FieldNode* head; FieldNode* tail; } FieldList;
+typedef struct ParamList { ParamNode* head; ParamNode* tail; } ParamList;
+
+// Everything a single compilation needs to scan and parse, so several
+// compilations can run at the same time on different threads
+typedef struct ParseContext {
+  void* scanner;
+  // The AST is allocated in the arena: libera(tree) or destroy_context
+  // releases all of it, including whatever a failed parse left behind
+  Node* tree;
+  Arena arena;
+  bool invalid_input;
+  // Syntax errors reported so far: the parser recovers from most of them
+  // and goes on looking for more
+  int error_count;
+
+  // Byte offset of the end of the text scanned so far
+  uint32_t scan_offset;
+
+  // Input installed by scan_file, scan_stream or scan_text, and the scanner
+  // buffer over it. String literals scanned from it are views into the
+  // source instead of copies.
+  Source source;
+  void* buffer;
+
+  // Tokens of the whole source, filled in by prelex. While there are any,
+  // yyparse reads them instead of calling the scanner.
+  LexedToken* tokens;
+  size_t token_count;
+  size_t token_index;
+
+  // When set, called with every global declaration as soon as it is
+  // parsed, see pipeline.c, until there is a syntax error
+  void (*declaration_parsed)(Node* declaration, void* data);
+  void* declaration_data;
+} ParseContext;
+
+void init_context(ParseContext* context);
+void destroy_context(ParseContext* context);
+int scan_file(ParseContext* context, const char* path);
+void scan_stream(ParseContext* context, FILE* stream);
+void scan_text(ParseContext* context, const char* text, size_t size);
+void release_source(ParseContext* context);
+void prelex(ParseContext* context, int threads);
+
+// Trees of unchanged sources cached on disk, see cache.c
+uint64_t hash_source(const Source* source);
+int load_cached_tree(ParseContext* context, const char* directory, uint64_t hash);
+int save_cached_tree(ParseContext* context, const char* directory, uint64_t hash);
+
+void get_position(ParseContext* context, uint32_t offset, int* line, int* column);
+int get_line_number(ParseContext* context);
+int get_column_number(ParseContext* context);
+}
 
+%code provides {
+// Pulls from the pre-lexed tokens when there are any, see prelex.c
+int next_token(YYSTYPE* lval, void* scanner);
 
+void syntax_error(void* scanner, int token, int expected);
 
-%code requires {
-#include "tree.h"
+// Hand-written parts of the parser, see expression.c. Both take over bison's
+// lookahead, if it has one, and leave the token that follows in it. Like
+// bison, they report no errors while it is `recovering` from an earlier one.
+Node* parse_expression(void* scanner, int* lookahead, YYSTYPE* lval, bool recovering);
+bool parse_arguments(void* scanner, int* lookahead, YYSTYPE* lval, bool recovering, Node** arguments);
 }
 
+%code {
+#include "lexer.h"
+
+#define yylex next_token
+
+void yyerror(void* scanner, char const *s);
+
+static void declaration_parsed(void* scanner, Node* declaration) {
+  ParseContext* context = yyget_extra(scanner);
+  // Once there is a syntax error the parse fails: whatever is recovered
+  // after it is only parsed for the errors it may have
+  if (context->declaration_parsed != NULL && !context->invalid_input)
+    context->declaration_parsed(declaration, context->declaration_data);
+}
+}
+
+%define api.pure full
+// Detect errors before any default reduction, so the error productions
+// can still resynchronize after a complete declaration or command
+%define parse.lac full
+%param {void* scanner}
+
 %union {
   Token token;
   Node* node;
   TypeNode* type;
   FieldNode* field;
   ParamNode* param;
+  NodeList nodes;
+  FieldList fields;
+  ParamList params;
   bool optional;
-  UnOpType unary_operator;
 }
 
 %token <token.value.type_keyword> TK_PR_INT
@@ -71,6 +164,8 @@ extern int get_column_number();
 %token <token.value.char_literal> TK_LIT_CHAR
 %token <token.value.string_literal> TK_LIT_STRING
 %token <token> TK_IDENTIFICADOR
+// Only read by the expression parser, declared for their names in errors
+%token '!' '?' '#' '+' '-' '*' '/' '%' '^' '<' '>' '&' '|' '.'
 %token TOKEN_ERRO
 
 %type <node> literal
@@ -84,23 +179,23 @@ extern int get_column_number();
 %type <token.value.int_literal> array_index
 
 %type <node> program
-%type <node> global_declarations
+%type <nodes> global_declarations
 %type <node> global_declaration
 
 %type <node> new_type;
-%type <field> field_list;
+%type <fields> field_list;
 %type <field> field;
 
 %type <node> global_var
 
 %type <node> function_declaration
 %type <param> function_params
-%type <param> param_list
+%type <params> param_list
 %type <param> param
 
 %type <node> body
 %type <node> block
-%type <node> commands
+%type <nodes> commands
 %type <node> command_or_case
 %type <node> command
 %type <node> command_with_comma
@@ -120,47 +215,35 @@ extern int get_column_number();
 %type <node> else_opt
 %type <node> foreach
 %type <node> for
-%type <node> commands_comma_separated
+%type <nodes> commands_comma_separated
 %type <node> do_while
 %type <node> while_do
 %type <node> switch
 %type <node> function_call
 %type <node> function
-%type <node> argument_list_opt
-%type <node> argument_list
-%type <node> argument
-%type <node> expression_list
+%type <node> arguments
+%type <nodes> expression_list
 %type <node> expression
-%type <node> pipe_expression
-%type <node> ternary_expression
-%type <node> logical_or_expression
-%type <node> logical_and_expression
-%type <node> relational_expression
-%type <node> additive_expression
-%type <node> multiplicative_expression
-%type <node> exponentiation_expression
-%type <node> unary_expression
-%type <node> operand
 %type <token.value.binary_operator> pipe_operator
-%type <token.value.binary_operator> logical_or_operator
-%type <token.value.binary_operator> logical_and_operator
-%type <token.value.binary_operator> relational_operator
-%type <token.value.binary_operator> additive_operator
-%type <token.value.binary_operator> multiplicative_operator
-%type <unary_operator> unary_operator
 
 %error-verbose
 
 %start program
 
-%destructor { if (invalid_input) { delete($$); } else { arvore = $$; } } program
-%destructor { delete($$); } <node>
-%destructor { free($$); $$ = NULL; } <token.value.string_literal>
-%destructor { free($$); $$ = NULL; } <token.value.identifier>
+%initial-action {
+  ParseContext* context = yyget_extra(scanner);
+  use_arena(&context->arena);
+  context->tree = NULL;
+  context->invalid_input = false;
+  context->error_count = 0;
+}
 
-%destructor { delete_type($$); $$ = NULL; } <type>
-%destructor { delete_param($$); $$ = NULL; } <param>
-%destructor { delete_field($$); $$ = NULL; } <field>
+// Nodes are never freed one by one: whatever an error leaves behind goes
+// back with the rest of the arena
+%destructor {
+  ParseContext* context = yyget_extra(scanner);
+  if (!context->invalid_input) { context->tree = $$; }
+} program
 
 %%
 
@@ -197,19 +280,33 @@ array_index: '[' TK_LIT_INT ']' { $$ = $2; };
 
 // Grammar
 
-program: global_declarations { $$ = $1; }
-       | %empty { $$ = NULL; };
-
-global_declarations: global_declaration global_declarations { $1->next = $2; $$ = $1; }
-                   | global_declaration { $$ = $1; };
+program: global_declarations
+      { ParseContext* context = yyget_extra(scanner);
+        // Errors were recovered from: the parse still fails
+        if (context->invalid_input)
+          YYABORT;
+        $$ = $1.head; };
+
+global_declarations:
+  global_declarations global_declaration
+      { $$ = $1;
+        if ($2 != NULL) {
+          if ($$.tail != NULL) $$.tail->next = $2; else $$.head = $2;
+          $$.tail = $2;
+          declaration_parsed(scanner, $2);
+        } }
+  | %empty { $$.head = $$.tail = NULL; };
 
 global_declaration: new_type { $$ = $1; }
                   | global_var { $$ = $1; }
-                  | function_declaration { $$ = $1; };
-
-new_type: TK_PR_CLASS TK_IDENTIFICADOR '[' field_list ']' ';' { $$ = make_type_decl($2, $4); };
-field_list: field ':' field_list { $1->next = $3; $$ = $1; }
-          | field { $$ = $1; };
+                  | function_declaration { $$ = $1; }
+                  // Skip a broken declaration up to where the next one may start
+                  | error ';' { $$ = NULL; }
+                  | error '}' { $$ = NULL; };
+
+new_type: TK_PR_CLASS TK_IDENTIFICADOR '[' field_list ']' ';' { $$ = make_type_decl($2, $4.head); };
+field_list: field_list ':' field { $1.tail->next = $3; $$.head = $1.head; $$.tail = $3; }
+          | field { $$.head = $$.tail = $1; };
 field: scope_opt base_type TK_IDENTIFICADOR { $$ = make_field($1, $2, $3.value.identifier); };
 
 global_var:
@@ -231,21 +328,29 @@ function_declaration:
       { $$ = make_function_decl($2, $3, true, $4, $5); };
 
 function_params: '(' ')' { $$ = NULL; }
-               | '(' param_list ')' { $$ = $2; };
+               | '(' param_list ')' { $$ = $2.head; };
 
-param_list: param ',' param_list { $1->next = $3; $$ = $1; }
-          | param;
+param_list: param_list ',' param { $1.tail->next = $3; $$.head = $1.head; $$.tail = $3; }
+          | param { $$.head = $$.tail = $1; };
 
 param: const_opt type TK_IDENTIFICADOR { $$ = make_param($1, $2, $3); };
 
 body: block;
 
-block: '{' commands '}' { $$ = make_block($2); };
-commands: command_or_case commands { $1->next = $2; $$ = $1; }
-        | %empty { $$ = NULL; };
+block: '{' commands '}' { $$ = make_block($2.head); }
+     | '{' commands error '}' { $$ = make_block($2.head); };
+commands: commands command_or_case
+            { $$ = $1;
+              if ($2 != NULL) {
+                if ($$.tail != NULL) $$.tail->next = $2; else $$.head = $2;
+                $$.tail = $2;
+              } }
+        | %empty { $$.head = $$.tail = NULL; };
 
 command_or_case: command ';'
-               | TK_PR_CASE TK_LIT_INT ':' { $$ = make_case($2); };
+               | TK_PR_CASE TK_LIT_INT ':' { $$ = make_case($2); }
+               // Skip a broken command up to its end
+               | error ';' { $$ = NULL; };
 
 command: command_with_comma
        | command_without_comma;
@@ -302,7 +407,7 @@ assign_or_shift: variable_access '=' expression
                     { $$ = make_shift_r($1, $3); };
 
 input: TK_PR_INPUT expression { $$ = make_input($2); };
-output: TK_PR_OUTPUT expression_list { $$ = make_output($2); };
+output: TK_PR_OUTPUT expression_list { $$ = make_output($2.head); };
 
 return: TK_PR_RETURN expression { $$ = make_return($2); };
 
@@ -319,14 +424,15 @@ else_opt: TK_PR_ELSE block { $$ = $2; }
         | %empty { $$ = NULL; };
 
 foreach: TK_PR_FOREACH '(' TK_IDENTIFICADOR ':' expression_list ')' block
-      { $$ = make_for_each($3.value.identifier, $5, $7); };
+      { $$ = make_for_each($3.value.identifier, $5.head, $7); };
 
 for: TK_PR_FOR '(' commands_comma_separated ':' expression ':' commands_comma_separated ')' block
-      { $$ = make_for($3, $5, $7, $9); };
+      { $$ = make_for($3.head, $5, $7.head, $9); };
 
 commands_comma_separated:
-      command_without_comma ',' commands_comma_separated { $1->next = $3; $$ = $1; }
-    | command_without_comma;
+      commands_comma_separated ',' command_without_comma
+          { $1.tail->next = $3; $$.head = $1.head; $$.tail = $3; }
+    | command_without_comma { $$.head = $$.tail = $1; };
 
 do_while: TK_PR_DO block TK_PR_WHILE '(' expression ')'
       { $$ = make_do_while($5, $2); };
@@ -342,108 +448,42 @@ function_call:
   | function pipe_operator function_call
         { $$ = make_bin_op($1, $2, $3); };
 
-function: TK_IDENTIFICADOR '(' argument_list_opt ')'
+function: TK_IDENTIFICADOR '(' arguments ')'
       { $$ = make_function_call($1.value.identifier, $3); };
 
-argument_list_opt:
-      argument_list
-    | %empty { $$ = NULL; };
-argument_list:
-      argument ',' argument_list { $1->next = $3; $$ = $1; }
-    | argument;
-argument:
-      expression
-    | '.' { $$ = make_dot(); };
+arguments: %empty { if (!parse_arguments(scanner, &yychar, &yylval, YYRECOVERING(), &$$)) YYERROR; };
 
+// Shared expressions are copied, since each element links to the next
 expression_list:
-      expression ',' expression_list { $1->next = $3; $$ = $1; }
-    | expression;
+      expression_list ',' expression
+          { $3 = unshared($3); $1.tail->next = $3; $$.head = $1.head; $$.tail = $3; }
+    | expression { $$.head = $$.tail = unshared($1); };
 
-expression: pipe_expression;
+// Parsed by hand, see expression.c
+expression: %empty { if (($$ = parse_expression(scanner, &yychar, &yylval, YYRECOVERING())) == NULL) YYERROR; };
 
 pipe_operator: TK_OC_BASH_PIPE | TK_OC_FORWARD_PIPE;
-pipe_expression:
-  ternary_expression
-  | pipe_expression pipe_operator ternary_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-ternary_expression:
-  logical_or_expression
-  | logical_or_expression '?' expression ':' ternary_expression
-      { $$ = make_tern_op($1, $3, $5); };
-
-logical_or_operator:
-      TK_OC_OR
-    | '|' { $$ = BIT_OR; } ;
-logical_or_expression:
-  logical_and_expression
-  | logical_or_expression logical_or_operator logical_and_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-logical_and_operator:
-      TK_OC_AND
-    | '&' { $$ = BIT_AND; } ;
-logical_and_expression:
-  relational_expression
-  | logical_and_expression logical_and_operator relational_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-relational_operator:
-      TK_OC_EQ
-    | TK_OC_NE
-    | TK_OC_GE
-    | TK_OC_LE
-    | '>' { $$ = GREATER; }
-    | '<' { $$ = LESS_THAN; };
-relational_expression:
-  additive_expression
-  | relational_expression relational_operator additive_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-additive_operator:
-      '+' { $$ = ADD; }
-    | '-' { $$ = SUBTRACT; };
-additive_expression:
-  multiplicative_expression
-  | additive_expression additive_operator multiplicative_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-multiplicative_operator:
-      '*' { $$ = MULTIPLY; }
-    | '/' { $$ = DIVIDE; }
-    | '%' { $$ = MODULO; };
-multiplicative_expression:
-  exponentiation_expression
-  | multiplicative_expression multiplicative_operator exponentiation_expression
-      { $$ = make_bin_op($1, $2, $3); };
-
-exponentiation_expression:
-  unary_expression
-  | exponentiation_expression '^' unary_expression
-      { $$ = make_bin_op($1, POW, $3); };
-
-unary_operator:
-      '!' { $$ = NOT; }
-    | '-' { $$ = MINUS; }
-    | '+' { $$ = PLUS; }
-    | '*' { $$ = VALUE; }
-    | '&' { $$ = ADDRESS; }
-    | '?' { $$ = EVAL_BOOL; }
-    | '#' { $$ = HASH; } ;
-unary_expression:
-  operand
-  | unary_operator unary_expression { $$ = make_un_op($2, $1); };
-
-operand:
-  variable_access
-  | function
-  | literal
-  | '(' expression ')' { $$ = $2; };
 
 %%
 
-void yyerror(const char* msg) {
-    invalid_input = true;
+void yyerror(void* scanner, const char* msg) {
+    ParseContext* context = yyget_extra(scanner);
+    context->invalid_input = true;
+    context->error_count++;
     char error_msg[] = "%s at line %d, column %d\n";
-    fprintf(stderr, error_msg, msg, get_line_number(), get_column_number());
+    fprintf(stderr, error_msg, msg, get_line_number(context), get_column_number(context));
+}
+
+// Reports a syntax error in the words bison uses. `expected` is YYEMPTY when
+// too many tokens could have come instead.
+void syntax_error(void* scanner, int token, int expected) {
+    char unexpected[64], expecting[64], msg[192];
+    yytnamerr(unexpected, yytname[YYTRANSLATE(token)]);
+    if (expected == YYEMPTY) {
+        snprintf(msg, sizeof(msg), "syntax error, unexpected %s", unexpected);
+    } else {
+        yytnamerr(expecting, yytname[YYTRANSLATE(expected)]);
+        snprintf(msg, sizeof(msg), "syntax error, unexpected %s, expecting %s", unexpected, expecting);
+    }
+    yyerror(scanner, msg);
 }
@@ -0,0 +1,169 @@
+/*
+Pipelined driver, an alternative to main.c with the same output for valid
+programs. Every global declaration goes to semantic checking as soon as
+the parser reduces it, and on to code generation once checked, so code for
+the first functions comes out while the rest of the file is still being
+parsed. Each stage runs on its own thread.
+
+On an erroneous program the code generated for the declarations before
+the error has already been written when the error is reported. Nothing
+parsed after a syntax error is checked or compiled, even when the parser
+recovers a whole declaration from it.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "parser.tab.h"
+#include "lexer.h"
+#include "semantic.h"
+#include "iloc.h"
+
+void libera (void *arvore);
+
+// Declarations on their way from one stage to the next
+typedef struct Queue {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  Node** items;
+  size_t head;
+  size_t count;
+  size_t capacity;
+  bool closed;
+} Queue;
+
+static void init_queue(Queue* queue) {
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->ready, NULL);
+  queue->items = NULL;
+  queue->head = 0;
+  queue->count = 0;
+  queue->capacity = 0;
+  queue->closed = false;
+}
+
+static void destroy_queue(Queue* queue) {
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->ready);
+  free(queue->items);
+}
+
+static void push(Queue* queue, Node* declaration) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->count == queue->capacity) {
+    queue->capacity = queue->capacity == 0 ? 256 : 2 * queue->capacity;
+    queue->items = realloc(queue->items, queue->capacity * sizeof(Node*));
+  }
+  queue->items[queue->count++] = declaration;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static void close_queue(Queue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = true;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+// Waits for the next declaration. NULL once the queue is closed and empty.
+static Node* pop(Queue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->head == queue->count && !queue->closed)
+    pthread_cond_wait(&queue->ready, &queue->lock);
+  Node* declaration = NULL;
+  if (queue->head < queue->count) {
+    declaration = queue->items[queue->head++];
+    // Start over whenever the consumer catches up
+    if (queue->head == queue->count)
+      queue->head = queue->count = 0;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return declaration;
+}
+
+typedef struct Pipeline {
+  Queue parsed;  // Waiting to be checked
+  Queue checked; // Waiting for their code
+  Source* source;
+  // First of the declarations handed out by the parser. They are linked
+  // in order, so this is the whole tree even after a syntax error.
+  Node* first;
+  int error;     // Semantic error, 0 if none
+} Pipeline;
+
+static void declaration_parsed(Node* declaration, void* data) {
+  Pipeline* pipeline = data;
+  if (pipeline->first == NULL)
+    pipeline->first = declaration;
+  push(&pipeline->parsed, declaration);
+}
+
+static void* check_stage(void* data) {
+  Pipeline* pipeline = data;
+  SymbolsTable* table = createTable();
+  table->source = pipeline->source;
+  Node* declaration;
+  while ((declaration = pop(&pipeline->parsed)) != NULL) {
+    // Like check_program, stop at the first error, but keep draining the
+    // queue until the parser is done
+    if (pipeline->error != 0)
+      continue;
+    pipeline->error = check_declaration(declaration, table);
+    if (pipeline->error == 0)
+      push(&pipeline->checked, declaration);
+  }
+  close_queue(&pipeline->checked);
+  delete_table(table);
+  return NULL;
+}
+
+static void* generate_stage(void* data) {
+  Pipeline* pipeline = data;
+  Node* declaration;
+  while ((declaration = pop(&pipeline->checked)) != NULL)
+    generate_declaration(declaration);
+  return NULL;
+}
+
+int main (int argc, char **argv)
+{
+  ParseContext context;
+  init_context(&context);
+  if (argc > 1) {
+    if (scan_file(&context, argv[1]) != 0) {
+      perror(argv[1]);
+      destroy_context(&context);
+      return 1;
+    }
+  } else
+    scan_stream(&context, stdin);
+  if (context.source.size >= PRELEX_MIN_SIZE)
+    prelex(&context, sysconf(_SC_NPROCESSORS_ONLN));
+
+  Pipeline pipeline;
+  init_queue(&pipeline.parsed);
+  init_queue(&pipeline.checked);
+  pipeline.source = &context.source;
+  pipeline.first = NULL;
+  pipeline.error = 0;
+  context.declaration_parsed = declaration_parsed;
+  context.declaration_data = &pipeline;
+
+  pthread_t checker, generator;
+  pthread_create(&checker, NULL, check_stage, &pipeline);
+  pthread_create(&generator, NULL, generate_stage, &pipeline);
+  int ret = yyparse(context.scanner);
+  close_queue(&pipeline.parsed);
+  pthread_join(checker, NULL);
+  pthread_join(generator, NULL);
+
+  if (ret == 0 && pipeline.error != 0) {
+    printf("Semantic error: %s\n", semantic_error_to_str(pipeline.error));
+    ret = pipeline.error;
+  }
+  libera(pipeline.first);
+  destroy_queue(&pipeline.parsed);
+  destroy_queue(&pipeline.checked);
+  destroy_context(&context);
+  return ret;
+}
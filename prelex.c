@@ -0,0 +1,163 @@
+// Parallel lexing of large sources into a flat token array.
+//
+// The source is cut right after newlines, and each chunk is lexed on its
+// own thread by a private scanner over a copy of it. Tokens never contain
+// a newline, so a cut can only go wrong inside a block comment: every
+// chunk is first lexed as if it started outside one, and once the state at
+// the end of the previous chunk is known, the rare chunk that guessed
+// wrong is lexed again.
+
+#include "lexer.h"
+#include <pthread.h>
+#include <string.h>
+
+// Chunks smaller than this are not worth a thread
+#define MIN_CHUNK_SIZE (256 << 10)
+
+typedef struct Chunk {
+  Source* source;
+  uint32_t start;
+  uint32_t end;
+  bool starts_in_comment;
+  bool ends_in_comment;
+
+  LexedToken* tokens;
+  size_t count;
+  size_t capacity;
+  // Offsets of invalid characters, see skip_column
+  uint32_t* skipped;
+  size_t skipped_count;
+} Chunk;
+
+static void lex_chunk(Chunk* chunk) {
+  const char* text = chunk->source->text + chunk->start;
+  size_t size = chunk->end - chunk->start;
+
+  ParseContext local;
+  init_context(&local);
+  scan_text(&local, text, size);
+  scanner_set_comment(local.scanner, chunk->starts_in_comment);
+  const char* copy = local.source.text;
+
+  chunk->count = 0;
+  YYSTYPE lval;
+  memset(&lval, 0, sizeof(lval));
+  int type;
+  while ((type = yylex(&lval, local.scanner)) != 0) {
+    if (chunk->count == chunk->capacity) {
+      chunk->capacity = chunk->capacity == 0 ? size / 4 + 16 : 2 * chunk->capacity;
+      chunk->tokens = realloc(chunk->tokens, chunk->capacity * sizeof(LexedToken));
+    }
+    LexedToken* t = &chunk->tokens[chunk->count++];
+    t->type = type;
+    t->end = chunk->start + local.scan_offset;
+    t->token = lval.token;
+    t->token.offset += chunk->start;
+
+    // String literals are views into the copy: point them into the source
+    StringNode* literal = &t->token.value.string_literal;
+    if (type == TK_LIT_STRING && literal->text >= copy && literal->text < copy + size)
+      literal->text = chunk->source->text + chunk->start + (literal->text - copy);
+  }
+  chunk->ends_in_comment = scanner_in_comment(local.scanner);
+
+  free(chunk->skipped);
+  chunk->skipped_count = local.source.skipped_count;
+  chunk->skipped = malloc(chunk->skipped_count * sizeof(uint32_t));
+  for (size_t i = 0; i < chunk->skipped_count; i++)
+    chunk->skipped[i] = chunk->start + local.source.skipped[i];
+
+  destroy_context(&local);
+}
+
+static void* lex_chunk_thread(void* chunk) {
+  lex_chunk(chunk);
+  return NULL;
+}
+
+// Lexes the whole source installed in the context on up to `threads`
+// threads. yyparse then reads the resulting tokens instead of scanning.
+void prelex(ParseContext* context, int threads) {
+  Source* source = &context->source;
+  size_t size = source->size;
+
+  size_t count = threads;
+  if (count > size / MIN_CHUNK_SIZE)
+    count = size / MIN_CHUNK_SIZE;
+  if (count < 1)
+    count = 1;
+
+  Chunk* chunks = calloc(count, sizeof(Chunk));
+  size_t chunk_count = 0;
+  uint32_t start = 0;
+  for (size_t i = 1; i <= count && start < size; i++) {
+    uint32_t end = size;
+    if (i < count) {
+      const char* newline = memchr(source->text + i * size / count, '\n', size - i * size / count);
+      if (newline == NULL || newline + 1 - source->text <= start)
+        continue;
+      end = newline + 1 - source->text;
+    }
+    Chunk* chunk = &chunks[chunk_count++];
+    chunk->source = source;
+    chunk->start = start;
+    chunk->end = end;
+    start = end;
+  }
+
+  pthread_t* workers = malloc(chunk_count * sizeof(pthread_t));
+  for (size_t i = 1; i < chunk_count; i++)
+    pthread_create(&workers[i], NULL, lex_chunk_thread, &chunks[i]);
+  if (chunk_count > 0)
+    lex_chunk(&chunks[0]);
+  for (size_t i = 1; i < chunk_count; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+
+  // Fix up the chunks that started inside a block comment
+  bool in_comment = false;
+  for (size_t i = 0; i < chunk_count; i++) {
+    if (chunks[i].starts_in_comment != in_comment) {
+      chunks[i].starts_in_comment = in_comment;
+      lex_chunk(&chunks[i]);
+    }
+    in_comment = chunks[i].ends_in_comment;
+  }
+
+  size_t total = 1;
+  for (size_t i = 0; i < chunk_count; i++)
+    total += chunks[i].count;
+  free(context->tokens);
+  context->tokens = malloc(total * sizeof(LexedToken));
+  context->token_count = 0;
+  context->token_index = 0;
+  for (size_t i = 0; i < chunk_count; i++) {
+    memcpy(context->tokens + context->token_count, chunks[i].tokens, chunks[i].count * sizeof(LexedToken));
+    context->token_count += chunks[i].count;
+    for (size_t j = 0; j < chunks[i].skipped_count; j++)
+      skip_column(source, chunks[i].skipped[j]);
+    free(chunks[i].tokens);
+    free(chunks[i].skipped);
+  }
+  free(chunks);
+
+  LexedToken* eof = &context->tokens[context->token_count++];
+  memset(eof, 0, sizeof(LexedToken));
+  eof->type = 0;
+  eof->end = size;
+  eof->token.offset = size;
+}
+
+int next_token(YYSTYPE* lval, void* scanner) {
+  ParseContext* context = yyget_extra(scanner);
+  if (context->tokens == NULL)
+    return yylex(lval, scanner);
+
+  // The last token is the end of input, which is returned for good
+  LexedToken* t = &context->tokens[context->token_index];
+  if (t->type != 0)
+    context->token_index++;
+  lval->token = t->token;
+  context->scan_offset = t->end;
+  return t->type;
+}
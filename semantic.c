@@ -1,14 +1,15 @@
 #include "semantic.h"
-
-#include <string.h>
+#include "iloc.h"
 
 // Se essa função retornar NULL, significa que o tipo passado não foi declarado (ERR_UNDECLARED)
 Symbol* makeSymbol(enum Nature nature, TypeNode* type, SymbolsTable* table) {
-  Symbol* s = malloc(sizeof(Symbol));
+  Symbol* s = newSymbol(table);
   s->nature = nature;
   s->type = type;
   s->params = NULL;
   s->fields = NULL;
+  s->layout = NULL;
+  s->storage = 0;
   if (type == NULL)
     s->size = 0;
   else {
@@ -16,14 +17,21 @@ Symbol* makeSymbol(enum Nature nature, TypeNode* type, SymbolsTable* table) {
     if (size == -1) return NULL;
     s->size = size;
   }
-  s->line = 0;
-  s->column = 0;
+  s->offset = 0;
+  s->memory = NULL;
   return s;
 }
 
+// A shared node is the operand of several nodes, which may each coerce it
+// differently: its coercions are left for its uses to work out again
+static void coerce(Node* node, int kind) {
+  if (!node->shared)
+    node->coerced_to = kind;
+}
+
 bool match(TypeNode* t1, TypeNode* t2) {
   if (t1->kind == CUSTOM_T && t2->kind == CUSTOM_T)
-    return strcmp(t1->name, t2->name) == 0;
+    return t1->name == t2->name;
   else
     return t1->kind == t2->kind;
 }
@@ -54,8 +62,9 @@ int convert(TypeNode expected, TypeNode actual) {
   return -1;
 }
 
-int check_program(Node* node) {
+int check_program(Node* node, Source* source) {
   SymbolsTable* table = createTable();
+  table->source = source;
   TypeNode t;
   int check = typecheck(node, table, &t);
   if (check != 0) {
@@ -65,9 +74,48 @@ int check_program(Node* node) {
   return check;
 }
 
-int typecheck_var(VariableNode* var, SymbolsTable* table, TypeNode* out) {
+// Checks what has no code, or whose value is already in a register,
+// without emitting any
+static int typecheck_quiet(Node* node, SymbolsTable* table, TypeNode* out) {
+  bool generate = table->generate;
+  table->generate = false;
+  int check = typecheck(node, table, out);
+  table->generate = generate;
+  return check;
+}
+
+// Parameters have no memory of their own: codegen finds them by name
+static Memory* symbol_memory(Symbol* s, Atom id) {
+  return s->memory != NULL ? s->memory : find_memory(id);
+}
+
+int compile_program(Node* node, Source* source) {
+  char* code;
+  size_t size;
+  code_output = open_memstream(&code, &size);
+  SymbolsTable* table = createTable();
+  table->source = source;
+  table->generate = true;
+  TypeNode t;
+  int check = typecheck(node, table, &t);
+  fclose(code_output);
+  code_output = NULL;
+  if (check != 0)
+    printf("Semantic error: %s\n", semantic_error_to_str(check));
+  else
+    fwrite(code, 1, size, stdout);
+  free(code);
+  delete_table(table);
+  return check;
+}
+
+// The symbol the variable refers to goes to `symbol`, and the number of
+// its storage to the variable
+int typecheck_var(VariableNode* var, SymbolsTable* table, TypeNode* out, Symbol** symbol) {
   Symbol* s = getSymbol(table, var->identifier);
+  *symbol = s;
   if (s == NULL) return ERR_UNDECLARED;
+  var->storage = s->storage;
   if (s->nature == NAT_FUNCTION) return ERR_FUNCTION;
   if (s->nature == NAT_CLASS) return ERR_USER;
   // Significa que foi usada como vetor e não é vetor na declaração (só pode ser simples)
@@ -76,7 +124,7 @@ int typecheck_var(VariableNode* var, SymbolsTable* table, TypeNode* out) {
   if (var->index == NULL && s->nature == NAT_VECTOR) return ERR_VECTOR;
   if (var->index != NULL) {
     TypeNode index;
-    int check = typecheck(var->index, table, &index);
+    int check = typecheck_quiet(var->index, table, &index);
     if (check != 0) return check;
 
     TypeNode intNode;
@@ -85,36 +133,25 @@ int typecheck_var(VariableNode* var, SymbolsTable* table, TypeNode* out) {
     if (final_type == -1)
       return ERR_WRONG_TYPE;
     if (final_type != index.kind) {
-      var->index->coerced_to = final_type;
+      coerce(var->index, final_type);
     }
   }
 
   if (var->field != NULL) {
     if (s->type->kind != CUSTOM_T)
       return ERR_VARIABLE;
-    char* type_name = s->type->name;
-    Symbol* s = getSymbol(table, type_name);
-    FieldNode* f = s->fields;
-    FieldNode* valid = NULL;
-    while (f != NULL) {
-      if (strcmp(f->identifier, var->field) == 0)
-        valid = f;
-      f = f->next;
-    }
-    if (valid == NULL) return ERR_UNDECLARED;
-    *out = *(valid->type);
+    Atom type_name = s->type->name;
+    ClassField* field = findField(getSymbol(table, type_name)->layout, var->field);
+    if (field == NULL) return ERR_UNDECLARED;
+    *out = *(field->field->type);
   } else {
     *out = *(s->type);
   }
   return 0;
 }
 
-int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
-  if (node == NULL)
-    return 0;
-
+int check_declaration(Node* node, SymbolsTable* table) {
   switch (node->type) {
-    // Global declarations
     case GLOBAL_VAR_DECL: {
       GlobalVarNode decl = node->value->global_var_node;
       #ifdef _DEBUG
@@ -132,11 +169,14 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       if (s == NULL) return ERR_UNDECLARED;
       if (decl.array_size > 0)
         s->size = decl.array_size * s->size;
-      s->line = node->line;
-      s->column = node->column;
+      s->offset = node->offset;
+      s->storage = ++table->storage_count;
+      decl.storage = node->value->global_var_node.storage = s->storage;
+      if (table->generate)
+        s->memory = global_var_code(decl);
       addSymbol(table, decl.identifier, s);
       print_table(table);
-      return typecheck(node->next, table, out);
+      return 0;
     }
     case TYPE_DECL: {
       TypeDeclNode decl = node->value->type_decl_node;
@@ -150,20 +190,13 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       Symbol* s = makeSymbol(NAT_CLASS, NULL, table);
       if (s == NULL) return ERR_UNDECLARED;
       s->fields = decl.field;
-
-      int size = 0;
-      FieldNode* f = decl.field;
-      while (f != NULL) {
-        size += size_for_type(f->type, table);
-        f = f->next;
-      }
-      s->size = size;
-      s->line = node->line;
-      s->column = node->column;
+      s->layout = newLayout(table, decl.field);
+      s->size = s->layout->size;
+      s->offset = node->offset;
       addSymbol(table, decl.identifier, s);
 
       print_table(table);
-      return typecheck(node->next, table, out);
+      return 0;
     }
     case FUNCTION_DECL: {
       FunctionDeclNode decl = node->value->function_decl_node;
@@ -177,8 +210,7 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       Symbol* s = makeSymbol(NAT_FUNCTION, decl.type, table);
       if (s == NULL) return ERR_UNDECLARED;
       s->params = decl.param;
-      s->line = node->line;
-      s->column = node->column;
+      s->offset = node->offset;
       setReturn(table, s);
       addSymbol(table, decl.identifier, s);
 
@@ -187,17 +219,117 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       while (param != NULL) {
         Symbol* s = makeSymbol(NAT_VARIABLE, param->type, table);
         if (s == NULL) return ERR_UNDECLARED;
-        s->line = param->line;
-        s->column = param->column;
+        s->offset = param->offset;
         addSymbol(table, param->identifier, s);
         param = param->next;
       }
       print_table(table);
-      int check = typecheck(decl.body, table, out);
+      Memory* outer = table->generate ? begin_function(node, table) : NULL;
+      TypeNode out;
+      int check = typecheck(decl.body, table, &out);
       if (check != 0) return check;
+      if (table->generate)
+        end_function(outer);
 
       popScope(table);
-      return typecheck(node->next, table, out); }
+      return 0; }
+    default:
+      return 0;
+  }
+}
+
+// A binary operator, once the type of its left operand is known
+static int typecheck_bin_op(Node* node, TypeNode left_type, SymbolsTable* table, TypeNode* out) {
+  BinOpNode bin = node->value->bin_op_node;
+
+  TypeNode right_type;
+  if (bin.type != BASH_PIPE && bin.type != FORWARD_PIPE) {
+    BinOpCode code;
+    if (table->generate)
+      code = begin_bin_op(bin.type);
+    int right = typecheck(bin.right, table, &right_type);
+    if (right != 0) return right;
+    if (table->generate)
+      end_bin_op(node, code);
+  }
+
+  switch (bin.type) {
+    case ADD:
+    case SUBTRACT:
+    case MULTIPLY:
+    case DIVIDE:
+    case MODULO:
+    case POW: {
+      // Only numerical types are accepted
+      int kind = infer(left_type, right_type);
+      if (kind == -1) return ERR_WRONG_TYPE;
+      out->kind = kind;
+      return 0; }
+    case GREATER:
+    case LESS_THAN:
+    case GREATER_EQUAL:
+    case LESS_EQUAL:
+    case EQUAL:
+    case NOT_EQUAL:
+      out->kind = BOOL_T;
+      // Check for numerical inference
+      int final_type = convert(left_type, right_type);
+      if (final_type == -1)
+        return ERR_WRONG_TYPE;
+      if (final_type != left_type.kind) {
+        //printf("\n%s coerced to %s\n", type_to_str(&left_type), kind_to_str(final_type));
+        coerce(bin.left, final_type);
+      }
+      return 0;
+    case AND:
+    case OR:
+      if (left_type.kind == BOOL_T && right_type.kind == BOOL_T) {
+        out->kind = BOOL_T;
+        return 0;
+      }
+      return ERR_WRONG_TYPE;
+    case BIT_AND:
+    case BIT_OR:
+      out->kind = BOOL_T;
+      // Check for numerical inference
+      if (convert(left_type, right_type) != -1)
+        return 0;
+      return ERR_WRONG_TYPE;
+    case BASH_PIPE:
+    case FORWARD_PIPE: {
+      Symbol* s = makeSymbol(NAT_VARIABLE, &left_type, table);
+      setDot(table, s);
+
+      int right = typecheck(bin.right, table, &right_type);
+      if (right != 0) return right;
+
+      clearDot(table);
+
+      *out = right_type;
+
+      return 0;
+    }
+  }
+  return 0;
+}
+
+int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
+  if (node == NULL)
+    return 0;
+  if (table->generate && (!has_code(node) || (node->shared && reuse_value(node))))
+    return typecheck_quiet(node, table, out);
+
+  switch (node->type) {
+    // Global declarations
+    case GLOBAL_VAR_DECL:
+    case TYPE_DECL:
+    case FUNCTION_DECL:
+      // The rest of the declarations in a loop: a program has any number
+      for (; node != NULL; node = node->next) {
+        int check = check_declaration(node, table);
+        if (check != 0) return check;
+      }
+      return 0;
 
     case VAR_DECL: {
       LocalVarNode decl = node->value->local_var_node;
@@ -219,23 +351,31 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
           return ERR_WRONG_TYPE;
         if (final_type != init_type.kind) {
           //printf("\n%s coerced to %s\n", type_to_str(&init_type), kind_to_str(final_type));
-          decl.init->coerced_to = final_type;
+          coerce(decl.init, final_type);
         }
 
         if (init_type.kind == STRING_T)
-          len = strlen(decl.init->value->string_node);
+          len = decl.init->value->string_node.length;
       }
 
       Symbol* s = makeSymbol(NAT_VARIABLE, decl.type, table);
       if (s == NULL) return ERR_UNDECLARED;
       if (len > - 1) s->size = len;
-      s->line = node->line;
-      s->column = node->column;
+      s->offset = node->offset;
+      s->storage = ++table->storage_count;
+      node->value->local_var_node.storage = s->storage;
+      if (table->generate) {
+        s->memory = local_memory(node);
+        if (decl.init != NULL)
+          init_code(s->memory, decl.identifier);
+      }
       addSymbol(table, decl.identifier, s);
       print_table(table);
       return 0;
     }
     case INT:
+      if (table->generate)
+        int_code(node->value->int_node);
       out->kind = INT_T;
       return 0;
     case FLOAT:
@@ -251,8 +391,13 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       out->kind = STRING_T;
       return 0;
     case VARIABLE: {
-      VariableNode var = node->value->var_node;
-      return typecheck_var(&var, table, out);
+      VariableNode shared = node->value->var_node;
+      VariableNode* var = node->shared ? &shared : &node->value->var_node;
+      Symbol* s;
+      int check = typecheck_var(var, table, out, &s);
+      if (check == 0 && table->generate)
+        var_access_code(node, symbol_memory(s, var->identifier));
+      return check;
     }
     case DOT: {
       Symbol* s = getDot(table);
@@ -261,76 +406,26 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       return 0;
     }
     case BIN_OP: {
-      BinOpNode bin = node->value->bin_op_node;
-
-      TypeNode left_type;
-      int left = typecheck(bin.left, table, &left_type);
-      if (left != 0) return left;
-
-      TypeNode right_type;
-      if (bin.type != BASH_PIPE && bin.type != FORWARD_PIPE) {
-        int right = typecheck(bin.right, table, &right_type);
-        if (right != 0) return right;
-      }
-
-      switch (bin.type) {
-        case ADD:
-        case SUBTRACT:
-        case MULTIPLY:
-        case DIVIDE:
-        case MODULO:
-        case POW: {
-          // Only numerical types are accepted
-          int kind = infer(left_type, right_type);
-          if (kind == -1) return ERR_WRONG_TYPE;
-          out->kind = kind;
-          return 0; }
-        case GREATER:
-        case LESS_THAN:
-        case GREATER_EQUAL:
-        case LESS_EQUAL:
-        case EQUAL:
-        case NOT_EQUAL:
-          out->kind = BOOL_T;
-          // Check for numerical inference
-          int final_type = convert(left_type, right_type);
-          if (final_type == -1)
-            return ERR_WRONG_TYPE;
-          if (final_type != left_type.kind) {
-            //printf("\n%s coerced to %s\n", type_to_str(&left_type), kind_to_str(final_type));
-            bin.left->coerced_to = final_type;
-          }
-          return 0;
-        case AND:
-        case OR:
-          if (left_type.kind == BOOL_T && right_type.kind == BOOL_T) {
-            out->kind = BOOL_T;
-            return 0;
-          }
-          return ERR_WRONG_TYPE;
-        case BIT_AND:
-        case BIT_OR:
-          out->kind = BOOL_T;
-          // Check for numerical inference
-          if (convert(left_type, right_type) != -1)
-            return 0;
-          return ERR_WRONG_TYPE;
-        case BASH_PIPE:
-        case FORWARD_PIPE: {
-          Symbol* s = makeSymbol(NAT_VARIABLE, &left_type, table);
-          setDot(table, s);
-
-          int right = typecheck(bin.right, table, &right_type);
-          if (right != 0) return right;
-
-          clearDot(table);
-
-          *out = right_type;
-
-          return 0;
-        }
+      // Down the left operands with a stack, then back up checking each
+      // operator, whose result is the left operand of the next
+      // When emitting, only down the operators codegen takes as a chain:
+      // the operand below has code of its own
+      NodeStack spine = {0};
+      Node* left = node;
+      while (left->type == BIN_OP && (!table->generate || continues_chain(left, spine.count))) {
+        if (table->generate)
+          enter_bin_op(left->value->bin_op_node.type);
+        push_node(&spine, left);
+        left = left->value->bin_op_node.left;
       }
-
+      TypeNode type;
+      int check = typecheck(left, table, &type);
+      while (check == 0 && spine.count > 0)
+        check = typecheck_bin_op(pop_node(&spine), type, table, &type);
+      free_stack(&spine);
+      if (check == 0)
+        *out = type;
+      return check;
     }
     case UN_OP: {
       UnOpNode un = node->value->un_op_node;
@@ -338,6 +433,8 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       TypeNode value_type;
       int type = typecheck(un.value, table, &value_type);
       if (type != 0) return type;
+      if (table->generate)
+        end_un_op(node);
 
       TypeNode bool_node;
       bool_node.kind = BOOL_T;
@@ -349,7 +446,7 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
             return final_type;
           if (final_type != value_type.kind) {
             //printf("\n%s coerced to %s\n", type_to_str(&value_type), kind_to_str(final_type));
-            node->coerced_to = final_type;
+            coerce(node, final_type);
           }
           out->kind = final_type;
           return 0; }
@@ -403,12 +500,15 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       AttrNode attr = node->value->attr_node;
 
       TypeNode var_type;
-      int check = typecheck_var(attr.var, table, &var_type);
+      Symbol* var;
+      int check = typecheck_var(attr.var, table, &var_type, &var);
       if (check != 0) return check;
 
       TypeNode value_type;
       check = typecheck(attr.value, table, &value_type);
       if (check != 0) return check;
+      if (table->generate)
+        store_code(symbol_memory(var, attr.var->identifier), attr.var->identifier);
 
       int final_type = convert(var_type, value_type);
       if (final_type == -1)
@@ -419,10 +519,9 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       }
 
       if (value_type.kind == STRING_T && attr.value->type == STRING) {
-        int len = strlen(attr.value->value->string_node);
-        Symbol* s = getSymbol(table, attr.var->identifier);
-        if (s != NULL && s->size == 0)
-          s->size = len;
+        int len = attr.value->value->string_node.length;
+        if (var->size == 0)
+          var->size = len;
       }
       *out = var_type;
       return 0;
@@ -432,7 +531,8 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       AttrNode attr = node->value->attr_node;
 
       TypeNode var_type;
-      int check = typecheck_var(attr.var, table, &var_type);
+      Symbol* var;
+      int check = typecheck_var(attr.var, table, &var_type, &var);
       if (check != 0) return check;
 
       TypeNode value_type;
@@ -468,7 +568,7 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       }
       if (arg != NULL) return ERR_EXCESS_ARGS;
       if (param != NULL) return ERR_MISSING_ARGS;
-      out->kind = s->type->kind;
+      *out = *(s->type);
       return 0;
     }
     case RETURN: {
@@ -536,6 +636,8 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
     case IF: {
       IfNode iff = node->value->if_node;
 
+      if (table->generate)
+        begin_if();
       TypeNode cond_type;
       int check = typecheck(iff.cond, table, &cond_type);
       if (check != 0) return check;
@@ -551,20 +653,28 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
         node->coerced_to = final_type;
       }
 
+      IfLabels labels;
+      if (table->generate)
+        labels = then_code();
       TypeNode then_type;
       check = typecheck(iff.then, table, &then_type);
       if (check != 0) return check;
+      if (table->generate)
+        else_code(labels);
 
       if (iff.else_node != NULL) {
         TypeNode else_type;
         check = typecheck(iff.else_node, table, &else_type);
         if (check != 0) return check;
       }
+      if (table->generate)
+        end_if(labels);
       return 0;
     }
     case WHILE: {
       WhileNode whilee = node->value->while_node;
 
+      int test_label = table->generate ? begin_while() : 0;
       TypeNode cond_type;
       int check = typecheck(whilee.cond, table, &cond_type);
       if (check != 0) return check;
@@ -573,26 +683,39 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
       b.kind = BOOL_T;
       if (convert(b, cond_type) == -1) return ERR_WRONG_TYPE;
 
+      WhileLabels labels;
+      if (table->generate)
+        labels = while_body_code(test_label);
       TypeNode body_type;
       check = typecheck(whilee.body, table, &body_type);
       if (check != 0) return check;
+      if (table->generate)
+        end_while(labels);
 
       return 0;
     }
     case DO_WHILE: {
       WhileNode whilee = node->value->do_while_node;
 
+      // The condition is checked first, but its code follows the body's:
+      // it is checked again as its code is emitted
       TypeNode cond_type;
-      int check = typecheck(whilee.cond, table, &cond_type);
+      int check = typecheck_quiet(whilee.cond, table, &cond_type);
       if (check != 0) return check;
 
       TypeNode b;
       b.kind = BOOL_T;
       if (convert(b, cond_type) == -1) return ERR_WRONG_TYPE;
 
+      int enter_label = table->generate ? begin_do_while() : 0;
       TypeNode body_type;
       check = typecheck(whilee.body, table, &body_type);
       if (check != 0) return check;
+      if (table->generate) {
+        do_while_test_code();
+        typecheck(whilee.cond, table, &cond_type);
+        end_do_while(enter_label);
+      }
 
       return 0;
     }
@@ -644,13 +767,16 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
     }
     case FOR_EACH: {
       ForEachNode for_each = node->value->for_each_node;
+      // The loop itself has no code, but its id hides the name
+      if (table->generate)
+        forget_name(for_each.id);
 
       Node* expr = for_each.expression;
       TypeNode common_type;
       bool isFirst = true;
       while (expr != NULL) {
         TypeNode exp_type;
-        int check = typecheck(expr, table, &exp_type);
+        int check = typecheck_quiet(expr, table, &exp_type);
         if (check != 0) return check;
         if (isFirst)
           common_type = exp_type;
@@ -659,12 +785,13 @@ int typecheck(Node* node, SymbolsTable* table, TypeNode* out) {
         expr = expr->next;
       }
 
-      Symbol* s = makeSymbol(NAT_VARIABLE, &common_type, table);
+      // The id is made in the loop's scope, and released with it
       pushScope(table);
+      Symbol* s = makeSymbol(NAT_VARIABLE, &common_type, table);
       addSymbol(table, for_each.id, s);
 
       TypeNode body_type;
-      int check = typecheck(for_each.body, table, &body_type);
+      int check = typecheck_quiet(for_each.body, table, &body_type);
       if (check != 0) return check;
 
       popScope(table);
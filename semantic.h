@@ -34,7 +34,16 @@
 
 int typecheck(Node* node, SymbolsTable* table, TypeNode* out);
 
-int check_program(Node* node);
+// The source is only used to print positions in debug dumps
+int check_program(Node* node, Source* source);
+// Checks the program and emits its code in a single walk, each construct
+// right after it is checked, with the output check_program and then
+// generate_code would give. The code is held back until the whole program
+// is found correct.
+int compile_program(Node* node, Source* source);
+// Checks one global declaration against the ones checked before it in the
+// same table, without moving on to the next
+int check_declaration(Node* node, SymbolsTable* table);
 
 const char* semantic_error_to_str(int e);
 
@@ -0,0 +1,149 @@
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void init_source(Source* source) {
+  source->text = NULL;
+  source->size = 0;
+  source->mapped_length = 0;
+  source->line_starts = NULL;
+  source->line_count = 0;
+  source->skipped = NULL;
+  source->skipped_count = 0;
+  source->skipped_capacity = 0;
+}
+
+void free_source(Source* source) {
+  if (source->mapped_length > 0)
+    munmap(source->text, source->mapped_length);
+  else
+    free(source->text);
+  free(source->line_starts);
+  free(source->skipped);
+  init_source(source);
+}
+
+int map_source(Source* source, const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  // Positions are 32-bit offsets
+  if (st.st_size > UINT32_MAX) {
+    close(fd);
+    errno = EFBIG;
+    return -1;
+  }
+
+  // Reserve room for the padding with an anonymous mapping and place the
+  // file over its start: bytes past EOF read as 0.
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = st.st_size;
+  size_t length = (size + SOURCE_PADDING + page - 1) / page * page;
+  char* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  if (size > 0 &&
+      mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, length);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  init_source(source);
+  source->text = base;
+  source->size = size;
+  source->mapped_length = length;
+  return 0;
+}
+
+void read_source(Source* source, FILE* stream) {
+  size_t size = 0, capacity = 1 << 16;
+  char* text = malloc(capacity + SOURCE_PADDING);
+  size_t read;
+  while ((read = fread(text + size, 1, capacity - size, stream)) > 0) {
+    size += read;
+    if (size == capacity) {
+      capacity *= 2;
+      text = realloc(text, capacity + SOURCE_PADDING);
+    }
+  }
+  memset(text + size, 0, SOURCE_PADDING);
+
+  init_source(source);
+  source->text = text;
+  source->size = size;
+}
+
+void copy_source(Source* source, const char* text, size_t size) {
+  init_source(source);
+  source->text = calloc(size + SOURCE_PADDING, 1);
+  memcpy(source->text, text, size);
+  source->size = size;
+}
+
+void skip_column(Source* source, uint32_t offset) {
+  if (source->skipped_count == source->skipped_capacity) {
+    source->skipped_capacity = source->skipped_capacity == 0 ? 16 : 2 * source->skipped_capacity;
+    source->skipped = realloc(source->skipped, source->skipped_capacity * sizeof(uint32_t));
+  }
+  source->skipped[source->skipped_count++] = offset;
+}
+
+static void build_line_table(Source* source) {
+  size_t capacity = 1024;
+  source->line_starts = malloc(capacity * sizeof(uint32_t));
+  source->line_starts[0] = 0;
+  source->line_count = 1;
+
+  const char* end = source->text + source->size;
+  const char* p = source->text;
+  while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+    p++;
+    if (source->line_count == capacity) {
+      capacity *= 2;
+      source->line_starts = realloc(source->line_starts, capacity * sizeof(uint32_t));
+    }
+    source->line_starts[source->line_count++] = p - source->text;
+  }
+}
+
+// Number of elements of the sorted array that are below `value`
+static size_t count_below(const uint32_t* array, size_t count, uint64_t value) {
+  size_t low = 0, high = count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (array[mid] < value)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+void source_position(Source* source, uint32_t offset, int* line, int* column) {
+  if (source->line_starts == NULL)
+    build_line_table(source);
+
+  size_t index = count_below(source->line_starts, source->line_count, (uint64_t) offset + 1) - 1;
+  uint32_t start = source->line_starts[index];
+  *line = index + 1;
+  *column = offset - start + 1;
+
+  // Invalid characters are rare, so this is usually skipped entirely
+  if (source->skipped_count > 0)
+    *column -= count_below(source->skipped, source->skipped_count, offset) -
+               count_below(source->skipped, source->skipped_count, start);
+}
@@ -0,0 +1,46 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Zeroed bytes guaranteed after the end of a source: flex needs two NULs
+// after its buffer and the hand-written lexer loads whole SIMD blocks that
+// may run past the last input byte
+#define SOURCE_PADDING 64
+
+// Text of one compilation unit. Tokens and nodes only record 32-bit byte
+// offsets into it; lines and columns are recovered on demand from a line
+// table that is built the first time a position is asked for.
+typedef struct Source {
+  char* text;
+  size_t size;
+  // Length of the mapping when the text is a mapped file, 0 when it is
+  // heap allocated
+  size_t mapped_length;
+
+  // Offsets of the first byte of every line, built lazily
+  uint32_t* line_starts;
+  size_t line_count;
+
+  // Offsets of invalid characters, which do not count towards columns
+  uint32_t* skipped;
+  size_t skipped_count;
+  size_t skipped_capacity;
+} Source;
+
+void init_source(Source* source);
+void free_source(Source* source);
+
+// Maps the file at `path` privately (writable, copy-on-write). Returns 0 on
+// success and -1 with errno set on failure.
+int map_source(Source* source, const char* path);
+// Reads the whole stream into memory
+void read_source(Source* source, FILE* stream);
+void copy_source(Source* source, const char* text, size_t size);
+
+void skip_column(Source* source, uint32_t offset);
+void source_position(Source* source, uint32_t offset, int* line, int* column);
+
+#endif
@@ -1,37 +1,157 @@
 #include "table.h"
-#include <string.h>
+
+#define INITIAL_CAPACITY 64
+
+// Tables made so far, numbering them
+static unsigned long checks = 0;
 
 SymbolsTable* createTable() {
   SymbolsTable* table = malloc(sizeof(SymbolsTable));
-  table->head = NULL;
+  table->slots = NULL;
+  table->capacity = 0;
+  table->names = 0;
+  table->log = NULL;
+  table->count = 0;
+  table->log_capacity = 0;
+  table->scopes = NULL;
+  table->depth = 0;
+  table->scopes_capacity = 0;
+  table->chunks = NULL;
+  table->chunk_count = 0;
+  table->symbols = 0;
+  table->layouts = NULL;
+  table->storage_count = 0;
   table->return_symbol = NULL;
+  table->dot_symbol = NULL;
+  table->source = NULL;
+  table->generate = false;
+  table->id = __atomic_add_fetch(&checks, 1, __ATOMIC_RELAXED);
+  table->hidden_classes = 0;
   return table;
 }
 
-void addSymbol(SymbolsTable* table, char* name, Symbol* symbol) {
-  SymbolElement* element = malloc(sizeof(SymbolElement));
-  element->isSeparator = false;
+// Atoms are interned, so their address is hashed and compared instead of
+// their text
+static size_t hash_name(Atom name) {
+  uint64_t h = (uintptr_t) name;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static SymbolSlot* find_slot(SymbolsTable* table, Atom name) {
+  size_t mask = table->capacity - 1;
+  size_t i = hash_name(name) & mask;
+  while (table->slots[i].name != NULL && table->slots[i].name != name)
+    i = (i + 1) & mask;
+  return &table->slots[i];
+}
+
+static void grow_slots(SymbolsTable* table) {
+  SymbolSlot* old = table->slots;
+  size_t old_capacity = table->capacity;
+  table->capacity = old_capacity == 0 ? INITIAL_CAPACITY : 2 * old_capacity;
+  table->slots = calloc(table->capacity, sizeof(SymbolSlot));
+  for (size_t i = 0; i < old_capacity; i++)
+    if (old[i].name != NULL)
+      *find_slot(table, old[i].name) = old[i];
+  free(old);
+}
+
+Symbol* newSymbol(SymbolsTable* table) {
+  size_t chunk = table->symbols / SYMBOL_CHUNK;
+  if (chunk == table->chunk_count) {
+    table->chunks = realloc(table->chunks, (chunk + 1) * sizeof(Symbol*));
+    table->chunks[chunk] = malloc(SYMBOL_CHUNK * sizeof(Symbol));
+    table->chunk_count++;
+  }
+  return &table->chunks[chunk][table->symbols++ % SYMBOL_CHUNK];
+}
+
+void addSymbol(SymbolsTable* table, Atom name, Symbol* symbol) {
+  if (2 * (table->names + 1) > table->capacity)
+    grow_slots(table);
+  SymbolSlot* slot = find_slot(table, name);
+  if (slot->name == NULL) {
+    slot->name = name;
+    slot->top = NO_SYMBOL;
+    table->names++;
+  }
+
+  if (table->count == table->log_capacity) {
+    table->log_capacity = table->log_capacity == 0 ? INITIAL_CAPACITY : 2 * table->log_capacity;
+    table->log = realloc(table->log, table->log_capacity * sizeof(SymbolElement));
+  }
+  SymbolElement* element = &table->log[table->count];
   element->symbol = symbol;
-  element->name = strdup(name);
-  element->next = table->head;
-  table->head = element;
+  element->name = name;
+  element->scope = table->depth;
+  element->shadowed = slot->top;
+  element->hides_class = slot->top != NO_SYMBOL && symbol->nature != NAT_CLASS
+                         && table->log[slot->top].symbol->nature == NAT_CLASS;
+  if (element->hides_class)
+    table->hidden_classes++;
+  slot->top = table->count++;
+}
+
+static SymbolElement* innermost(SymbolsTable* table, Atom name) {
+  if (table->capacity == 0)
+    return NULL;
+  SymbolSlot* slot = find_slot(table, name);
+  if (slot->name == NULL || slot->top == NO_SYMBOL)
+    return NULL;
+  return &table->log[slot->top];
 }
 
-Symbol* getSymbol(SymbolsTable* table, char* name) {
-  SymbolElement* element = table->head;
-  while (element != NULL &&
-    (element->isSeparator || strcmp(name, element->name) != 0))
-    element = element->next;
+ClassLayout* newLayout(SymbolsTable* table, FieldNode* fields) {
+  ClassLayout* layout = malloc(sizeof(ClassLayout));
+  size_t count = 0;
+  for (FieldNode* f = fields; f != NULL; f = f->next)
+    count++;
+  layout->capacity = 1;
+  while (layout->capacity < 2 * count)
+    layout->capacity *= 2;
+  layout->fields = calloc(layout->capacity, sizeof(ClassField));
+
+  int offset = 0;
+  size_t mask = layout->capacity - 1;
+  for (FieldNode* f = fields; f != NULL; f = f->next) {
+    size_t i = hash_name(f->identifier) & mask;
+    while (layout->fields[i].name != NULL && layout->fields[i].name != f->identifier)
+      i = (i + 1) & mask;
+    layout->fields[i] = (ClassField) { f->identifier, f, offset };
+    offset += size_for_type(f->type, table);
+  }
+  layout->size = offset;
+
+  layout->next = table->layouts;
+  table->layouts = layout;
+  return layout;
+}
+
+ClassField* findField(ClassLayout* layout, Atom name) {
+  if (layout == NULL)
+    return NULL;
+  size_t mask = layout->capacity - 1;
+  size_t i = hash_name(name) & mask;
+  while (layout->fields[i].name != NULL) {
+    if (layout->fields[i].name == name)
+      return &layout->fields[i];
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+Symbol* getSymbol(SymbolsTable* table, Atom name) {
+  SymbolElement* element = innermost(table, name);
   if (element == NULL) return NULL;
   else return element->symbol;
 }
 
-Symbol* getSymbolCurrentScope(SymbolsTable* table, char* name) {
-  SymbolElement* element = table->head;
-  while (element != NULL &&
-    (!element->isSeparator && strcmp(name, element->name) != 0))
-    element = element->next;
-  if (element == NULL) return NULL;
+Symbol* getSymbolCurrentScope(SymbolsTable* table, Atom name) {
+  SymbolElement* element = innermost(table, name);
+  if (element == NULL || element->scope != table->depth) return NULL;
   else return element->symbol;
 }
 
@@ -60,46 +180,50 @@ Symbol* getDot(SymbolsTable* table) {
   return table->dot_symbol;
 }
 
-void delete_symbol(Symbol* symbol) {
-  free(symbol);
-}
-
-void delete_element(SymbolElement* element) {
-  if (element->name != NULL) free(element->name);
-  if (element->next != NULL) delete_element(element->next);
-  if (element->symbol != NULL) delete_symbol(element->symbol);
-  free(element);
+// Takes the bindings of the scope off the log, innermost first, and
+// releases the symbols made in it all at once
+static void unwind(SymbolsTable* table, SymbolScope scope) {
+  while (table->count > scope.log) {
+    SymbolElement* element = &table->log[--table->count];
+    find_slot(table, element->name)->top = element->shadowed;
+    if (element->hides_class)
+      table->hidden_classes--;
+  }
+  table->symbols = scope.symbols;
 }
 
+// Nothing is taken off one by one: the symbols all live in the chunks
 void delete_table(SymbolsTable* table) {
-  if (table->head) {
-    delete_element(table->head);
-  }
-  if (table->dot_symbol) {
-    delete_symbol(table->dot_symbol);
+  while (table->layouts != NULL) {
+    ClassLayout* layout = table->layouts;
+    table->layouts = layout->next;
+    free(layout->fields);
+    free(layout);
   }
+  for (size_t i = 0; i < table->chunk_count; i++)
+    free(table->chunks[i]);
+  free(table->chunks);
+  free(table->slots);
+  free(table->log);
+  free(table->scopes);
   free(table);
 }
 
 void pushScope(SymbolsTable* table) {
-  SymbolElement* element = malloc(sizeof(SymbolElement));
-  element->isSeparator = true;
-  element->symbol = NULL;
-  element->name = NULL;
-  element->next = table->head;
-  table->head = element;
+  if (table->depth == table->scopes_capacity) {
+    table->scopes_capacity = table->scopes_capacity == 0 ? 16 : 2 * table->scopes_capacity;
+    table->scopes = realloc(table->scopes, table->scopes_capacity * sizeof(SymbolScope));
+  }
+  table->scopes[table->depth++] = (SymbolScope) { table->count, table->symbols };
 }
 
+// Without a scope to pop, everything goes
 void popScope(SymbolsTable* table) {
-    while (table->head != NULL) {
-      SymbolElement* cur = table->head;
-      bool shouldTerminate = cur->isSeparator;
-      table->head = cur->next;
-      cur->next = NULL;
-      delete_element(cur);
-
-      if (shouldTerminate) return;
-    }
+  if (table->depth == 0) {
+    unwind(table, (SymbolScope) { 0, 0 });
+    return;
+  }
+  unwind(table, table->scopes[--table->depth]);
 }
 
 void print_table(SymbolsTable* table) {
@@ -107,24 +231,29 @@ void print_table(SymbolsTable* table) {
     return;
   #endif
     printf("\n  vvvvvvvvvvvvvvvvvvvvv\n");
-    SymbolElement* element = table->head;
-    while (element != NULL) {
-      if (element->isSeparator) {
+    // Innermost first, with a line where each scope starts
+    size_t scope = table->depth;
+    for (size_t i = table->count; ; i--) {
+      while (scope > 0 && table->scopes[scope - 1].log == i) {
         printf("\n  return: %s\n", table->return_symbol ? type_to_str(table->return_symbol->type) : "void");
         printf("  ---------------------\n");
-      } else {
-        print_symbol(element->name, element->symbol);
+        scope--;
       }
-      element = element->next;
+      if (i == 0)
+        break;
+      print_symbol(table->log[i - 1].name, table->log[i - 1].symbol, table->source);
     }
     printf("  ^^^^^^^^^^^^^^^^^^^^^^\n\n");
 }
 
-void print_symbol(const char* name, Symbol* symbol) {
+void print_symbol(const char* name, Symbol* symbol, Source* source) {
   int i = 0;
+  int line = 0, column = 0;
+  if (source != NULL)
+    source_position(source, symbol->offset, &line, &column);
   switch(symbol->nature) {
     case NAT_CLASS:
-      printf("  - class %s [%d] (%d, %d)\n", name, symbol->size, symbol->line, symbol->column);
+      printf("  - class %s [%d] (%d, %d)\n", name, symbol->size, line, column);
       FieldNode* fields = symbol->fields;
       while (fields != NULL) {
         printf("    field %d: %s %s [%d]\n", i++, type_to_str(fields->type), fields->identifier, size_for_type(fields->type, NULL));
@@ -132,7 +261,7 @@ void print_symbol(const char* name, Symbol* symbol) {
       }
       break;
     case NAT_FUNCTION:
-      printf("  - function %s: %s (%d, %d)\n", name, type_to_str(symbol->type), symbol->line, symbol->column);
+      printf("  - function %s: %s (%d, %d)\n", name, type_to_str(symbol->type), line, column);
       ParamNode* params = symbol->params;
       while (params != NULL) {
         printf("    param %d: %s %s\n", i++, type_to_str(params->type), params->identifier);
@@ -140,7 +269,7 @@ void print_symbol(const char* name, Symbol* symbol) {
       }
       break;
     default:
-      printf("  - %s %s [%d] (%d, %d)\n", type_to_str(symbol->type), name, symbol->size, symbol->line, symbol->column);
+      printf("  - %s %s [%d] (%d, %d)\n", type_to_str(symbol->type), name, symbol->size, line, column);
       break;
   }  
 }
@@ -153,9 +282,18 @@ int size_for_type(TypeNode* type, SymbolsTable* table) {
     case BOOL_T: return 1;
     case STRING_T: return 0;
     case CUSTOM_T: {
+      // Classes are global and never redeclared, so the size of one stays
+      // the same for the rest of the check once it is known, unless some
+      // local hides a class: then the name is looked up again
+      if (table != NULL && type->sized_in == table->id && table->hidden_classes == 0)
+        return type->size;
       Symbol* s = getSymbol(table, type->name);
       if (s == NULL) return -1;
-      else return s->size; }
+      if (s->nature == NAT_CLASS) {
+        type->size = s->size;
+        type->sized_in = table->id;
+      }
+      return s->size; }
   }
   return -1;
 }
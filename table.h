@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "tree.h"
+#include "source.h"
 
 enum Nature {
   NAT_LITERAL_INT,
@@ -17,26 +18,97 @@ enum Nature {
   NAT_CLASS
  };
 
+typedef struct ClassField {
+  Atom name;
+  FieldNode* field;
+  // Bytes from the start of the object
+  int offset;
+} ClassField;
+
+// Where each field of a class is, worked out once as the class is checked
+typedef struct ClassLayout {
+  // Open addressing over the field names; capacity is a power of two
+  ClassField* fields;
+  size_t capacity;
+  int size;
+  struct ClassLayout* next;
+} ClassLayout;
+
 typedef struct Symbol {
-  int line, column;
+  uint32_t offset;
   int size;
   enum Nature nature;
   TypeNode* type;
   ParamNode* params;
   FieldNode* fields;
+  // Only for classes
+  ClassLayout* layout;
+  // Where the code of compile_program keeps the variable, NULL if nowhere
+  struct memory* memory;
+  // The number of the variable's storage, see GlobalVarNode
+  uint32_t storage;
 } Symbol;
 
+// A binding in the undo log of the table. Popping a scope takes its
+// bindings off the log and brings back those they shadowed
 typedef struct SymbolElement {
-  bool isSeparator;
   Symbol* symbol;
-  char* name;
-  struct SymbolElement* next;
+  Atom name;
+  // How many scopes were pushed when it was bound
+  size_t scope;
+  // The binding of the same name it hides, NO_SYMBOL if none
+  size_t shadowed;
+  // Whether what it hides is a class
+  bool hides_class;
 } SymbolElement;
 
+#define NO_SYMBOL ((size_t) -1)
+
+// Every name bound so far, with its innermost binding
+typedef struct SymbolSlot {
+  Atom name;
+  size_t top;
+} SymbolSlot;
+
+// Where a scope starts, in the log and in the symbols made
+typedef struct SymbolScope {
+  size_t log;
+  size_t symbols;
+} SymbolScope;
+
+#define SYMBOL_CHUNK 256
+
 typedef struct SymbolsTable {
-  SymbolElement* head;
+  // Open addressing with linear probing; capacity is always a power of two
+  SymbolSlot* slots;
+  size_t capacity;
+  size_t names;
+  SymbolElement* log;
+  size_t count;
+  size_t log_capacity;
+  SymbolScope* scopes;
+  size_t depth;
+  size_t scopes_capacity;
+  // Symbols are made in chunks of SYMBOL_CHUNK, which are kept to be
+  // reused once their symbols go with the scope they were made in
+  Symbol** chunks;
+  size_t chunk_count;
+  size_t symbols;
+  // Every class layout, kept until the table is deleted
+  ClassLayout* layouts;
   Symbol* return_symbol;
   Symbol* dot_symbol;
+  // Only used to print symbol positions in debug dumps
+  Source* source;
+  // Whether typecheck emits the code of what it checks, see compile_program
+  bool generate;
+  // Tells the sizes of classes found by this check from those of others
+  unsigned long id;
+  // Bindings in scope that hide a class: while there are any, the name of
+  // a class may stand for something else, see size_for_type
+  size_t hidden_classes;
+  // Storage numbered so far
+  uint32_t storage_count;
 } SymbolsTable;
 
 SymbolsTable* createTable();
@@ -44,19 +116,25 @@ void delete_table(SymbolsTable* table);
 
 void pushScope(SymbolsTable* table);
 void popScope(SymbolsTable* table);
-void addSymbol(SymbolsTable* table, char* name, Symbol* symbol);
+// A symbol that lasts until the scope it is made in is popped
+Symbol* newSymbol(SymbolsTable* table);
+void addSymbol(SymbolsTable* table, Atom name, Symbol* symbol);
+// A later field of the same name hides an earlier one
+ClassLayout* newLayout(SymbolsTable* table, FieldNode* fields);
+// NULL if the class has no such field, or if there is no class
+ClassField* findField(ClassLayout* layout, Atom name);
 void setReturn(SymbolsTable* table, Symbol* symbol);
 void setDot(SymbolsTable* table, Symbol* symbol);
 void clearDot(SymbolsTable* table);
 
-Symbol* getSymbol(SymbolsTable* table, char* name);
-Symbol* getSymbolCurrentScope(SymbolsTable* table, char* name);
+Symbol* getSymbol(SymbolsTable* table, Atom name);
+Symbol* getSymbolCurrentScope(SymbolsTable* table, Atom name);
 // Se retorno não está definido, encerra execução
 Symbol* getReturn(SymbolsTable* table);
 Symbol* getDot(SymbolsTable* table);
 
 void print_table(SymbolsTable* table);
-void print_symbol(const char* name, Symbol* symbol);
+void print_symbol(const char* name, Symbol* symbol, Source* source);
 int size_for_type(TypeNode* type, SymbolsTable* table);
 
 #endif
\ No newline at end of file
@@ -1,19 +1,38 @@
 #include "catch.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include "../parser.tab.h"
-#include "../lex.yy.h"
+#include "../lexer.h"
+#include "../semantic.h"
+#include "../iloc.h"
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+void libera(Node* node);
 }
 
-struct yy_buffer_state;
-typedef struct yy_buffer_state *YY_BUFFER_STATE;
-extern YY_BUFFER_STATE yy_scan_string(const char* str);
+static ParseContext* new_context() {
+    ParseContext* context = new ParseContext;
+    init_context(context);
+    return context;
+}
+
+// All parser tests share one context
+static ParseContext* context = new_context();
+
+static void scan_string(const char* str) { scan_text(context, str, strlen(str)); }
+static int parse() { return yyparse(context->scanner); }
 
 TEST_CASE("Empty program")
 {
-    yy_scan_string("");
-    REQUIRE(yyparse() == 0);
+    scan_string("");
+    REQUIRE(parse() == 0);
 }
 
 TEST_CASE("Type Declarations")
@@ -22,40 +41,40 @@ TEST_CASE("Type Declarations")
     // Positive tests
 
     SECTION("New Simple Type") {
-        yy_scan_string("class Real [ float value ];");
-        REQUIRE(yyparse() == 0);
+        scan_string("class Real [ float value ];");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("New Compound Type") {
-        yy_scan_string("class Complex [ float real : float imaginary ];");
-        REQUIRE(yyparse() == 0);
+        scan_string("class Complex [ float real : float imaginary ];");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Allows Scope") {
-        yy_scan_string("class Complex [ private float real : float imaginary ];");
-        REQUIRE(yyparse() == 0);
+        scan_string("class Complex [ private float real : float imaginary ];");
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Class Type in Field") {
-        yy_scan_string("class Natural [ Real value ];");
-        REQUIRE(yyparse() == 1);
+        scan_string("class Natural [ Real value ];");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Separator At End") {
-        yy_scan_string("class Complex [ float real : float imaginary : ];");
-        REQUIRE(yyparse() == 1);
+        scan_string("class Complex [ float real : float imaginary : ];");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("No Semicolon") {
-        yy_scan_string("class Complex [ float real : float imaginary ]");
-        REQUIRE(yyparse() == 1);
+        scan_string("class Complex [ float real : float imaginary ]");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Only One Scope") {
-        yy_scan_string("class Complex [ private public float real ];");
-        REQUIRE(yyparse() == 1);
+        scan_string("class Complex [ private public float real ];");
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -65,55 +84,55 @@ TEST_CASE("Global Variable Declarations")
     // Positive tests
 
     SECTION("Basic Variable") {
-        yy_scan_string("a int;");
-        REQUIRE(yyparse() == 0);
+        scan_string("a int;");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("New Type Varialbe") {
-        yy_scan_string("a Complex;");
-        REQUIRE(yyparse() == 0);
+        scan_string("a Complex;");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Array Variable") {
-        yy_scan_string("a[5] char;");
-        REQUIRE(yyparse() == 0);
+        scan_string("a[5] char;");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Static Variable") {
-        yy_scan_string("a static int;");
-        REQUIRE(yyparse() == 0);
+        scan_string("a static int;");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Static Array Variable") {
-        yy_scan_string("a[5] static int;");
-        REQUIRE(yyparse() == 0);
+        scan_string("a[5] static int;");
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("No Semicolon") {
-        yy_scan_string("int a");
-        REQUIRE(yyparse() == 1);
+        scan_string("int a");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Missing type") {
-        yy_scan_string("a;");
-        REQUIRE(yyparse() == 1);
+        scan_string("a;");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Missing identifier") {
-        yy_scan_string("int;");
-        REQUIRE(yyparse() == 1);
+        scan_string("int;");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Wrong order") {
-        yy_scan_string("int a;");
-        REQUIRE(yyparse() == 1);
+        scan_string("int a;");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Array Variable Float Value") {
-        yy_scan_string("char a[5.0];");
-        REQUIRE(yyparse() == 1);
+        scan_string("char a[5.0];");
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -123,45 +142,45 @@ TEST_CASE("Function Declarations")
     // Positive tests
 
     SECTION("Empty Parameters") {
-        yy_scan_string("int f() {}");
-        REQUIRE(yyparse() == 0);
+        scan_string("int f() {}");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Static Function") {
-        yy_scan_string("static char foo() {}");
-        REQUIRE(yyparse() == 0);
+        scan_string("static char foo() {}");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("One Parameter") {
-        yy_scan_string("string fas(char c) {}");
-        REQUIRE(yyparse() == 0);
+        scan_string("string fas(char c) {}");
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Multiple Parameters") {
-        yy_scan_string("bool f_4(int a, char b) {}");
-        REQUIRE(yyparse() == 0);
+        scan_string("bool f_4(int a, char b) {}");
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Finish With Semicolon") {
-        yy_scan_string("int f() {};");
-        REQUIRE(yyparse() == 1);
+        scan_string("int f() {};");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("No Body") {
-        yy_scan_string("int f()");
-        REQUIRE(yyparse() == 1);
+        scan_string("int f()");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Array as return") {
-        yy_scan_string("string[] f() {}");
-        REQUIRE(yyparse() == 1);
+        scan_string("string[] f() {}");
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Array as Parameter") {
-        yy_scan_string("char f(int[] a) {}");
-        REQUIRE(yyparse() == 1);
+        scan_string("char f(int[] a) {}");
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -171,68 +190,68 @@ TEST_CASE("Local Variable Declarations")
     // Positive tests
 
     SECTION("Simple variable") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " int a;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Custom type") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " Real a;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Static Const") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " static const int a;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Only Const") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " const Real a;"
                      "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Only Static") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " static int a;"
                      "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("With attribution literal") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " int a <= 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("With attribution identifier") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " int a <= b;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Const Static") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " const static Real a;"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Custom type with attribution") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " Real a <= 5;"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
 }
@@ -242,29 +261,29 @@ TEST_CASE("Command block")
     // Positive tests
 
     SECTION("Empty block") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " {};"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Simple block")
     {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " {"
                        "  int a;"
                        " };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("No-semicolon block") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " {}"
                        "}");
-        REQUIRE(yyparse() != 0);
+        REQUIRE(parse() != 0);
     }
 }
 
@@ -274,40 +293,40 @@ TEST_CASE("Attributions")
     // Positive tests
 
     SECTION("Simple variable") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Array variable") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a[4] = 'a';"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Field variable") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a$field = 3 + 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Array field variable") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " a[3+2]$field_2 = 5 > 2;"
                      "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Missing value") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " a = ;"
                      "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
 }
@@ -319,33 +338,33 @@ TEST_CASE("Input and Output")
     // Positive tests
 
     SECTION("Simple Input") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " input 4 > 2 + 1;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Simple Output") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " output true | false;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound Output") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " output \"string\" & 3, 'a', -10 * +4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Empty Output") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " output;"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -356,40 +375,40 @@ TEST_CASE("Function call")
     // Positive tests
 
     SECTION("Empty parameters") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " f();"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("One parameter") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " foo(false);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Dot parameter") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " bar(.);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Multiple parameters") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " bar(a, 4, ., 'c');"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Trailing comma") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " bar(a, 4, .,);"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -400,31 +419,31 @@ TEST_CASE("Shifts")
     // Positive tests
 
     SECTION("Simple variable shift") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a << 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Array shift") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a[4] >> 'a';"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Field shift") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a$field << a;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Array field Shift") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " a[3+2]$field_2 = 3 \% 4;"
                      "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
@@ -437,61 +456,61 @@ TEST_CASE("Exit and Return commands")
     // Positive tests
 
     SECTION("Return command") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " return 4 + 3;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Break command") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " break;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Continue command") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " continue;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Case command") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " case 3:"
                      "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Case with float") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " case 3.2:"
                      "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Case with semicolon") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " case 3;"
                      "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Case with expression") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " case 3 + 2:"
                      "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("Continue without semicolon") {
-      yy_scan_string("int main() {"
+      scan_string("int main() {"
                      " continue"
                      "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -502,138 +521,138 @@ TEST_CASE("Flow commands")
     // Positive tests
 
     SECTION("Simple if") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " if (3) then { };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Simple if else") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " if (3 > 1) then { } else { };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound if-else") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " if (\"as\") then { if (true) then { return 4; } else { }; } else { };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Simple foreach") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " foreach ( a: 3) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound foreach") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " foreach ( a: 3, 4, 'a') { output a; };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Simple for") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (i = 0: i < 3: i = i + 1) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("For with list in first") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (i = 0, j = 1: i < 3: i = i + 1) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("For with list in second") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (i = 0: i < 3: i = i + 1, break) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("while") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " while (i > 3) do { case 3: };"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("do while") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " do { input \"test\"; } while (i > 3);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("switch") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " switch (3+4) { case 7: continue; case 1: break;};"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("If without semicolon") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " if (true) then { } else { }"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("foreach trailing comma") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " foreach ( a: 3, 4, 'a', ) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("foreach empty") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " foreach ( a: ) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("for empty first list") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (: i < 3: i + 1) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("for empty second list") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (i = 0: i < 3:) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("for with output command") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (output 3: i < 3: i + 1) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("for with case command") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " for (case 3: i < 3: i + 1) { output a; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("while with list") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " while (i > 3, j < 3) do { break; };"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -644,40 +663,40 @@ TEST_CASE("Pipe Commands")
     // Positive tests
 
     SECTION("Bash pipe") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " f() \%|\% g(a);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Forward pipe") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " f(.) \%>\% g(4, .);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound pipe") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " f() \%|\% g() \%>\% foo(., .);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Missing second argument") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " f() \%|\%;"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 
     SECTION("With non-function call") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " 4 \%|\% f();"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
     }
 }
 
@@ -688,208 +707,328 @@ TEST_CASE("Expression Parts")
     // Positive tests
 
     SECTION("Int as expressions") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Float as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4.2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Char as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 'c';"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("String as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = \"test\";"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("True as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = true;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("False as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = false;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Pipe as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = f(.) \%>\% g(4, .);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Variable as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = b;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Variable array as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = b[3 + 2];"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Variable field as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = b$field;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Variable array field as expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = b[3]$field;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Parenthesis expression expression") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = (3 + 4);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 }
 
 
+// Fully parenthesized form of an expression tree
+static std::string expression_tree(Node* node) {
+    static const char* binary[] = { "+", "-", "*", "/", "%", "^", ">", "<", ">=", "<=", "==",
+                                    "!=", "&&", "||", "&", "|", "%|%", "%>%" };
+    static const char* unary[] = { "!", "-", "+", "&", "*", "?", "#" };
+    switch (node->type) {
+        case INT:
+            return std::to_string(node->value->int_node);
+        case VARIABLE: {
+            VariableNode* var = &node->value->var_node;
+            std::string text = var->identifier;
+            if (var->index != NULL)
+                text += "[" + expression_tree(var->index) + "]";
+            if (var->field != NULL)
+                text += std::string("$") + var->field;
+            return text;
+        }
+        case FUNCTION_CALL: {
+            std::string text = std::string(node->value->function_call_node.identifier) + "(";
+            for (Node* argument = node->value->function_call_node.arguments; argument != NULL; argument = argument->next)
+                text += expression_tree(argument) + (argument->next != NULL ? ", " : "");
+            return text + ")";
+        }
+        case DOT:
+            return ".";
+        case BIN_OP:
+            return "(" + expression_tree(node->value->bin_op_node.left) + " " + binary[node->value->bin_op_node.type] +
+                   " " + expression_tree(node->value->bin_op_node.right) + ")";
+        case UN_OP:
+            return std::string("(") + unary[node->value->un_op_node.type] + expression_tree(node->value->un_op_node.value) + ")";
+        case TERN_OP:
+            return "(" + expression_tree(node->value->tern_op_node.cond) + " ? " + expression_tree(node->value->tern_op_node.exp1) +
+                   " : " + expression_tree(node->value->tern_op_node.exp2) + ")";
+        default:
+            return "?";
+    }
+}
+
+// Parses `expression` as the right side of an attribution
+static std::string parse_expression(const char* expression) {
+    std::string source = std::string("int main() { a = ") + expression + "; }";
+    scan_string(source.c_str());
+    if (parse() != 0)
+        return "";
+    Node* attr = context->tree->value->function_decl_node.body->value->block_node.value;
+    std::string tree = expression_tree(attr->value->attr_node.value);
+    libera(context->tree);
+    return tree;
+}
+
+TEST_CASE("Expression trees")
+{
+    SECTION("Precedence") {
+        REQUIRE(parse_expression("1 + 2 * 3") == "(1 + (2 * 3))");
+        REQUIRE(parse_expression("1 * 2 + 3") == "((1 * 2) + 3)");
+        REQUIRE(parse_expression("a < b + 1 == c") == "((a < (b + 1)) == c)");
+        REQUIRE(parse_expression("a && b || c & d | e") == "(((a && b) || (c & d)) | e)");
+        REQUIRE(parse_expression("-a ^ 2 * 3") == "(((-a) ^ 2) * 3)");
+        REQUIRE(parse_expression("-(1 + 2) * 3") == "((-(1 + 2)) * 3)");
+    }
+
+    SECTION("Associativity") {
+        REQUIRE(parse_expression("1 - 2 - 3") == "((1 - 2) - 3)");
+        REQUIRE(parse_expression("2 ^ 3 ^ 4") == "((2 ^ 3) ^ 4)");
+        REQUIRE(parse_expression("a %>% b %|% c") == "((a %>% b) %|% c)");
+        REQUIRE(parse_expression("a ? b : c ? d : e") == "(a ? b : (c ? d : e))");
+    }
+
+    SECTION("Ternary") {
+        REQUIRE(parse_expression("a + b ? c %>% d : e || f") == "((a + b) ? (c %>% d) : (e || f))");
+        REQUIRE(parse_expression("a %>% b ? c : d %|% e") == "((a %>% (b ? c : d)) %|% e)");
+        REQUIRE(parse_expression("a ? b ? c : d : e") == "(a ? (b ? c : d) : e)");
+    }
+
+    SECTION("Unary operators") {
+        REQUIRE(parse_expression("!?#a") == "(!(?(#a)))");
+        REQUIRE(parse_expression("*&b[1 + 2]$x") == "(*(&b[(1 + 2)]$x))");
+        REQUIRE(parse_expression("a * -b - +c") == "((a * (-b)) - (+c))");
+        REQUIRE(parse_expression("a & &b") == "(a & (&b))");
+    }
+
+    SECTION("Operands") {
+        REQUIRE(parse_expression("f(.) %>% g(4, ., h()) %|% k(x[i]$y)") == "((f(.) %>% g(4, ., h())) %|% k(x[i]$y))");
+        REQUIRE(parse_expression("b$field + c[(1)]") == "(b$field + c[1])");
+    }
+
+    SECTION("Errors") {
+        REQUIRE(parse_expression("1 +") == "");
+        REQUIRE(parse_expression("(1 + 2") == "");
+        REQUIRE(parse_expression("a ? b") == "");
+        REQUIRE(parse_expression("f(1, )") == "");
+        REQUIRE(parse_expression("f(1 2)") == "");
+        REQUIRE(parse_expression("b$") == "");
+        REQUIRE(parse_expression("b[1") == "");
+        REQUIRE(parse_expression("1 2") == "");
+    }
+}
+
+TEST_CASE("Parser throughput", "[.][benchmark]")
+{
+    std::string unit =
+        "int f(int n) {\n"
+        "  a = (b + 1) * c - d / 2 ^ e;\n"
+        "  if (a > 0 && b <= c || !d) then { x[i + 1]$y = -a * (b % 3); };\n"
+        "  output g(a, b - 1) %>% h(., 2), a ? b + 1 : c * 2;\n"
+        "  return a + b * c - d;\n"
+        "}\n";
+    std::string source;
+    while (source.size() < (16 << 20))
+        source += unit;
+    scan_string(source.c_str());
+
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(parse() == 0);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    libera(context->tree);
+
+    WARN(source.size() / elapsed.count() / (1 << 20) << " MB/s");
+}
+
 TEST_CASE("Compound Expressions")
 {
 
     // Positive tests
 
     SECTION("Negative Int") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = -4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Positive Int") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = +4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Negative Float") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = -4.2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Positive Float") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = +4.2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Sum of Negatives") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = -4 + -4.2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Subtraction of Negatives") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = -4 - -4.2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Greater or equal operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4 >= 3;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Less or equal operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4 <= 3;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("equal operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4 == (3 + 2);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("not equal operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = true != 3 - 2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("and operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = true && false;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("or operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = 4 || 3;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("prefix pointer operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = *b;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("prefix address operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = &b;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("prefix not operator") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = !b;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("prefix and infix operators") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = !b + +2 - -3;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
@@ -902,46 +1041,925 @@ TEST_CASE("Ternary Expression")
     // Positive tests
 
     SECTION("Simple") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = t ? 4 : 2;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound then") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = t ? 4 + 2 : 4;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound then else") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = t ? -5 * +a : f() \%|\% g(.);"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Compound condition") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = a*2 > 5 ? 4 : 1;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     SECTION("Nested ternary") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = a > 2 ? t ? 5 : 1 : 6;"
                        "}");
-        REQUIRE(yyparse() == 0);
+        REQUIRE(parse() == 0);
     }
 
     // Negative tests
 
     SECTION("Nested ternary without closing") {
-        yy_scan_string("int main() {"
+        scan_string("int main() {"
                        " a = a > 2 ? t ? 5 : 1;"
                        "}");
-        REQUIRE(yyparse() == 1);
+        REQUIRE(parse() == 1);
+    }
+}
+
+TEST_CASE("Independent contexts")
+{
+    ParseContext first, second;
+    init_context(&first);
+    init_context(&second);
+    const char first_source[] = "a int; int f() { a = a + 1; }";
+    const char second_source[] = "int g() { int b <= ; }";
+    scan_text(&first, first_source, sizeof(first_source) - 1);
+    scan_text(&second, second_source, sizeof(second_source) - 1);
+
+    int first_result, second_result;
+    std::thread first_thread([&] { first_result = yyparse(first.scanner); });
+    std::thread second_thread([&] { second_result = yyparse(second.scanner); });
+    first_thread.join();
+    second_thread.join();
+
+    REQUIRE(first_result == 0);
+    REQUIRE(first.tree != NULL);
+    REQUIRE(second_result == 1);
+    REQUIRE(second.invalid_input);
+
+    destroy_context(&first);
+    destroy_context(&second);
+}
+
+TEST_CASE("Error recovery")
+{
+    SECTION("Every broken command is reported") {
+        scan_string("int f() {"
+                    " a = 1 +;"
+                    " b = 2;"
+                    " c = (3;"
+                    " d = f(1, 2);"
+                    " output;"
+                    "}");
+        REQUIRE(parse() == 1);
+        REQUIRE(context->error_count == 3);
+    }
+
+    SECTION("Broken declarations are skipped") {
+        scan_string("a int b;"
+                    "int f() { a = 1; };"
+                    "class c [ int ];"
+                    "int g(int x y) { return x; }"
+                    "d float;");
+        REQUIRE(parse() == 1);
+        REQUIRE(context->error_count == 4);
+    }
+
+    SECTION("A block resynchronizes at its end") {
+        scan_string("int f() { if (a) then { b = 1 }; c = ; }");
+        REQUIRE(parse() == 1);
+        REQUIRE(context->error_count == 2);
+    }
+
+    SECTION("Valid input after errors still fails") {
+        scan_string("a int; b; c int;");
+        REQUIRE(parse() == 1);
+        REQUIRE(context->error_count == 1);
+        REQUIRE(context->tree == NULL);
+    }
+
+    SECTION("No errors") {
+        scan_string("a int; int f() { a = 1; }");
+        REQUIRE(parse() == 0);
+        REQUIRE(context->error_count == 0);
+    }
+}
+
+// Sends everything printed to stdout to /dev/null while in scope
+struct DiscardStdout {
+    int saved;
+    DiscardStdout() {
+        fflush(stdout);
+        saved = dup(1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        close(null);
+    }
+    ~DiscardStdout() {
+        fflush(stdout);
+        dup2(saved, 1);
+        close(saved);
     }
+};
+
+TEST_CASE("Deep trees are walked without recursion")
+{
+    // Each would take a stack frame or more per statement, declaration or
+    // operand in a recursive walk, far beyond the default stack size
+    std::string source = "int f() { int x <= 1;";
+    for (int i = 0; i < 1000000; i++)
+        source += " x = 1;";
+    source += " x = x";
+    for (int i = 0; i < 100000; i++)
+        source += " + x";
+    source += "; }";
+    scan_string(source.c_str());
+    REQUIRE(parse() == 0);
+    {
+        DiscardStdout discard;
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+        generate_code(context->tree);
+        print(context->tree);
+    }
+    libera(context->tree);
+
+    source.clear();
+    for (int i = 0; i < 1000000; i++)
+        source += "g" + std::to_string(i) + " int;\n";
+    scan_string(source.c_str());
+    REQUIRE(parse() == 0);
+    {
+        DiscardStdout discard;
+        generate_code(context->tree);
+        print(context->tree);
+    }
+    libera(context->tree);
+}
+
+static void collect_declaration(Node* declaration, void* data) {
+    static_cast<std::vector<Node*>*>(data)->push_back(declaration);
+}
+
+TEST_CASE("Declarations handed out as parsed")
+{
+    std::vector<Node*> declarations;
+    context->declaration_parsed = collect_declaration;
+    context->declaration_data = &declarations;
+
+    scan_string("a int; class c [ int x ]; int f() { a = 1; } b float;");
+    REQUIRE(parse() == 0);
+    REQUIRE(declarations.size() == 4);
+    Node* node = context->tree;
+    for (Node* declaration : declarations) {
+        REQUIRE(declaration == node);
+        node = node->next;
+    }
+    libera(context->tree);
+
+    // After a syntax error the declarations handed out are still there,
+    // linked in order
+    declarations.clear();
+    scan_string("a int; int f() { a = 1; } b float c;");
+    REQUIRE(parse() == 1);
+    REQUIRE(declarations.size() == 2);
+    REQUIRE(declarations[0]->next == declarations[1]);
+    REQUIRE(declarations[1]->value->function_decl_node.body != NULL);
+    libera(declarations[0]);
+
+    context->declaration_parsed = NULL;
+    context->declaration_data = NULL;
+}
+
+TEST_CASE("Trees are released with their arena")
+{
+    scan_string("int f() { x[1] = 2; y << 3; break; }");
+    REQUIRE(parse() == 0);
+    REQUIRE(context->arena.chunks != NULL);
+    Node* command = context->tree->value->function_decl_node.body->value->block_node.value;
+    REQUIRE(std::string(command->value->attr_node.var->identifier) == "x");
+    REQUIRE(command->value->attr_node.var->index->value->int_node == 1);
+    REQUIRE(command->next->value->shift_l_node.var->index == NULL);
+    REQUIRE(command->next->next->type == BREAK);
+    libera(context->tree);
+    REQUIRE(context->arena.chunks == NULL);
+
+    // What a failed parse allocated stays in the arena until it is released
+    scan_string("int f() { x = ; }");
+    REQUIRE(parse() == 1);
+    REQUIRE(context->tree == NULL);
+    REQUIRE(context->arena.chunks != NULL);
+
+    scan_string("a int;");
+    REQUIRE(parse() == 0);
+    REQUIRE(std::string(context->tree->value->global_var_node.identifier) == "a");
+    libera(context->tree);
+    REQUIRE(context->arena.chunks == NULL);
+}
+
+TEST_CASE("Long lists")
+{
+    // Far more elements than the parser stack could hold if the list rules
+    // kept them all on it
+    const int count = 1000000;
+    std::string source;
+    for (int i = 0; i < count; i++)
+        source += "g" + std::to_string(i) + " int;\n";
+    scan_string(source.c_str());
+    REQUIRE(parse() == 0);
+
+    int length = 0;
+    Node* last = NULL;
+    for (Node* node = context->tree; node != NULL; node = node->next) {
+        last = node;
+        length++;
+    }
+    REQUIRE(length == count);
+    REQUIRE(std::string(context->tree->value->global_var_node.identifier) == "g0");
+    REQUIRE(std::string(last->value->global_var_node.identifier) == "g" + std::to_string(count - 1));
+    libera(context->tree);
+
+    source = "int f() { output 0";
+    for (int i = 1; i < count; i++)
+        source += ", " + std::to_string(i);
+    source += ";";
+    for (int i = 0; i < count; i++)
+        source += " x = " + std::to_string(i) + ";";
+    source += " }";
+    scan_string(source.c_str());
+    REQUIRE(parse() == 0);
+
+    Node* command = context->tree->value->function_decl_node.body->value->block_node.value;
+    int value = 0;
+    for (Node* node = command->value->output_node.value; node != NULL; node = node->next)
+        REQUIRE(node->value->int_node == value++);
+    REQUIRE(value == count);
+    value = 0;
+    for (Node* node = command->next; node != NULL; node = node->next)
+        REQUIRE(node->value->attr_node.value->value->int_node == value++);
+    REQUIRE(value == count);
+    libera(context->tree);
+}
+
+static std::string read_file(const std::string& path) {
+    std::string data;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return data;
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.append(buffer, size);
+    fclose(file);
+    return data;
+}
+
+TEST_CASE("Cached trees")
+{
+    char first[] = "/tmp/gast_testXXXXXX";
+    char second[] = "/tmp/gast_testXXXXXX";
+    REQUIRE(mkdtemp(first) != NULL);
+    REQUIRE(mkdtemp(second) != NULL);
+    const char* source =
+        "class Pair [ int left : private float right ];\n"
+        "pair Pair; text string; values[3] int;\n"
+        "static int f(const int a, float b) {\n"
+        "  int i <= a; pair$left = i + 2 * a; text = \"cached\";\n"
+        "  if (a > 1 && !(b < 2.5)) then { i = -i; } else { output i, \"no\"; };\n"
+        "  while (i < 10) do { i = i + 1; continue; };\n"
+        "  for (i = 0 : i < 3 : i = i + 1) { values[i] = i; };\n"
+        "  return f(i, b);\n"
+        "}\n";
+
+    scan_string(source);
+    uint64_t hash = hash_source(&context->source);
+    REQUIRE(parse() == 0);
+    REQUIRE(save_cached_tree(context, first, hash) == 0);
+    libera(context->tree);
+
+    // The same source is rebuilt from the cache without parsing it
+    scan_string(source);
+    REQUIRE(hash_source(&context->source) == hash);
+    REQUIRE(load_cached_tree(context, first, hash) == 0);
+    Node* tree = context->tree;
+    REQUIRE(tree->type == TYPE_DECL);
+    Node* function = tree->next->next->next->next;
+    REQUIRE(function->type == FUNCTION_DECL);
+    REQUIRE(std::string(function->value->function_decl_node.identifier) == "f");
+    Node* command = function->value->function_decl_node.body->value->block_node.value;
+    REQUIRE(std::string(command->value->local_var_node.identifier) == "i");
+    REQUIRE(command->next->next->value->attr_node.value->type == STRING);
+
+    // Saved again, the tree gives back the same file
+    char file[64];
+    snprintf(file, sizeof(file), "/%016llx.gast", (unsigned long long) hash);
+    REQUIRE(save_cached_tree(context, second, hash) == 0);
+    std::string cached = read_file(first + std::string(file));
+    REQUIRE(!cached.empty());
+    REQUIRE(read_file(second + std::string(file)) == cached);
+    libera(context->tree);
+
+    // A different source misses
+    scan_string("a int;");
+    REQUIRE(load_cached_tree(context, first, hash_source(&context->source)) == -1);
+    REQUIRE(load_cached_tree(context, first, hash) == -1);
+    REQUIRE(parse() == 0);
+    libera(context->tree);
+
+    unlink((first + std::string(file)).c_str());
+    unlink((second + std::string(file)).c_str());
+    rmdir(first);
+    rmdir(second);
+}
+
+// The cache file of `source`, saved in `directory` once it is parsed, and
+// checked if asked
+static std::string cached_file(const char* directory, const char* source, bool checked) {
+    scan_string(source);
+    uint64_t hash = hash_source(&context->source);
+    REQUIRE(parse() == 0);
+    if (checked) {
+        DiscardStdout discard;
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+    }
+    REQUIRE(save_cached_tree(context, directory, hash) == 0);
+    libera(context->tree);
+    char file[64];
+    snprintf(file, sizeof(file), "/%016llx.gast", (unsigned long long) hash);
+    return directory + std::string(file);
+}
+
+// Loads `source` from `data`, written over its cache file
+static int load_changed(const std::string& path, const char* source, const std::string& data) {
+    FILE* file = fopen(path.c_str(), "wb");
+    REQUIRE(fwrite(data.data(), 1, data.size(), file) == data.size());
+    fclose(file);
+    scan_string(source);
+    int ret = load_cached_tree(context, path.substr(0, path.rfind('/')).c_str(),
+                               hash_source(&context->source));
+    if (ret == 0)
+        libera(context->tree);
+    else
+        release_source(context);
+    return ret;
+}
+
+TEST_CASE("Cached trees with values out of range")
+{
+    char directory[] = "/tmp/gast_testXXXXXX";
+    REQUIRE(mkdtemp(directory) != NULL);
+    // The bytes of the records past the header that tell each pair apart:
+    // the operator, the scope and the coercion
+    const char* pairs[][2] = {
+        {"int f() { int x <= 1; x = x + 1; }", "int f() { int x <= 1; x = x - 1; }"},
+        {"int f() { int x <= 1; x = -x; }", "int f() { int x <= 1; x = !x; }"},
+        {"a int; class P [ private int a ];", "a int; class P [ public int a ];"},
+    };
+    const size_t header = 56;
+    for (auto& pair : pairs) {
+        std::string path = cached_file(directory, pair[0], false);
+        std::string data = read_file(path);
+        std::string other = read_file(cached_file(directory, pair[1], false));
+        unlink(cached_file(directory, pair[1], false).c_str());
+        REQUIRE(data.size() == other.size());
+        REQUIRE(load_changed(path, pair[0], data) == 0);
+        std::string changed = data;
+        for (size_t i = header; i < data.size(); i++)
+            if (data[i] != other[i])
+                changed[i] = (char) 0xee;
+        REQUIRE(changed != data);
+        REQUIRE(load_changed(path, pair[0], changed) == -1);
+        unlink(path.c_str());
+    }
+
+    const char* coerced = "a float; int f() { a = 1; }";
+    std::string path = cached_file(directory, coerced, false);
+    std::string data = read_file(path);
+    std::string checked = read_file(cached_file(directory, coerced, true));
+    std::string changed = checked;
+    for (size_t i = header; i < data.size(); i++)
+        if (data[i] != checked[i])
+            changed[i] = (char) 0xee;
+    REQUIRE(changed != checked);
+    REQUIRE(load_changed(path, coerced, checked) == 0);
+    REQUIRE(load_changed(path, coerced, changed) == -1);
+    unlink(path.c_str());
+
+    // A class type without a name: the kind of q's type taken from the
+    // second source, the missing name from the first
+    const char* named = "p Pair; q bool;";
+    path = cached_file(directory, named, false);
+    data = read_file(path);
+    std::string other = read_file(cached_file(directory, "p Pair; q Pair;", false));
+    unlink(cached_file(directory, "p Pair; q Pair;", false).c_str());
+    REQUIRE(data.size() == other.size());
+    size_t kind = header;
+    while (kind < data.size() && data[kind] == other[kind])
+        kind++;
+    REQUIRE(other[kind] == CUSTOM_T);
+    changed = data;
+    changed[kind] = CUSTOM_T;
+    REQUIRE(load_changed(path, named, changed) == -1);
+    unlink(path.c_str());
+    rmdir(directory);
+}
+
+// Whatever is written to stdout while it is in scope
+struct CaptureStdout {
+    int saved;
+    FILE* file;
+    CaptureStdout() {
+        fflush(stdout);
+        saved = dup(1);
+        file = tmpfile();
+        dup2(fileno(file), 1);
+    }
+    std::string text() {
+        fflush(stdout);
+        std::string data;
+        rewind(file);
+        char buffer[4096];
+        size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            data.append(buffer, size);
+        return data;
+    }
+    ~CaptureStdout() {
+        fflush(stdout);
+        dup2(saved, 1);
+        close(saved);
+        fclose(file);
+    }
+};
+
+static int count(const std::string& text, const std::string& word) {
+    int found = 0;
+    for (size_t at = text.find(word); at != std::string::npos; at = text.find(word, at + 1))
+        found++;
+    return found;
+}
+
+extern "C" {
+extern int reg_counter, label_counter, global_offset, local_offset;
+extern Memory* global_memory;
+}
+
+// Code of the tree in the context, with numbering started over
+static std::string compile(bool fused, int* check) {
+    reg_counter = label_counter = global_offset = local_offset = 0;
+    global_memory = NULL;
+    CaptureStdout capture;
+    if (fused)
+        *check = compile_program(context->tree, &context->source);
+    else if ((*check = check_program(context->tree, &context->source)) == 0)
+        generate_code(context->tree);
+    return capture.text();
+}
+
+TEST_CASE("Shared expressions")
+{
+    share_expressions(&context->arena, true);
+    scan_string("int f(int p, int q) { int a <= 1; int b <= 2; int x <= 0;"
+                " x = a * b + a * b; output a * b, a * b, f(a * b, a * b);"
+                " a = 3; x = a * b; }");
+    REQUIRE(parse() == 0);
+
+    Node* command = context->tree->value->function_decl_node.body->value->block_node.value;
+    Node* sum = command->next->next->next->value->attr_node.value;
+    REQUIRE(sum->shared);
+    Node* product = sum->value->bin_op_node.left;
+    REQUIRE(product->shared);
+    REQUIRE(sum->value->bin_op_node.right == product);
+
+    // List elements are copies, each with its own link to the next
+    Node* output = command->next->next->next->next;
+    Node* first = output->value->output_node.value;
+    Node* second = first->next;
+    REQUIRE(first != second);
+    REQUIRE(!first->shared);
+    REQUIRE(first->value->bin_op_node.left == product->value->bin_op_node.left);
+    REQUIRE(second->value->bin_op_node.right == product->value->bin_op_node.right);
+    Node* arguments = second->next->value->function_call_node.arguments;
+    REQUIRE(arguments != first);
+    REQUIRE(arguments->next != NULL);
+    REQUIRE(arguments->next->next == NULL);
+
+    Node* last = output->next->next;
+    REQUIRE(last->value->attr_node.value == product);
+
+    // a * b is computed once before a is stored to, and once after, with
+    // b read only once
+    std::string code;
+    {
+        CaptureStdout capture;
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+        generate_code(context->tree);
+        code = capture.text();
+    }
+    REQUIRE(count(code, "\nmult ") == 2);
+    REQUIRE(count(code, "\nadd ") == 1);
+    REQUIRE(count(code, " = b\n") == 1);
+    REQUIRE(count(code, "\ni2i ") == 2);
+    libera(context->tree);
+
+    share_expressions(&context->arena, false);
+    scan_string("int f() { x = a * b; y = a * b; }");
+    REQUIRE(parse() == 0);
+    command = context->tree->value->function_decl_node.body->value->block_node.value;
+    REQUIRE(command->value->attr_node.value != command->next->value->attr_node.value);
+    REQUIRE(!command->value->attr_node.value->shared);
+    libera(context->tree);
+}
+
+TEST_CASE("Shared values forgotten when a name is hidden")
+{
+    // The local x hides the global one before it is stored to
+    share_expressions(&context->arena, true);
+    scan_string("x int; int f() { int a; a = x + 1; int x; a = x; }"
+                " int g() { int a; a = x * 2; foreach (x : 1, 2) { a = 1; }; a = x * 2; }");
+    REQUIRE(parse() == 0);
+    int check;
+    std::string code = compile(false, &check);
+    REQUIRE(check == 0);
+    REQUIRE(compile(true, &check) == code);
+    REQUIRE(check == 0);
+    REQUIRE(code.find("i2i ") == std::string::npos);
+    REQUIRE(count(code, " = x\n") == 4);
+    libera(context->tree);
+    share_expressions(&context->arena, false);
+}
+
+TEST_CASE("Shared expressions in cached trees")
+{
+    char directory[] = "/tmp/gast_testXXXXXX";
+    REQUIRE(mkdtemp(directory) != NULL);
+    const char* source = "a int; x int; int f() { a = x + 2; a = x + 2; output x + 2, (x + 2) * 3; }";
+    char file[64];
+
+    share_expressions(&context->arena, true);
+    scan_string(source);
+    uint64_t hash = hash_source(&context->source);
+    snprintf(file, sizeof(file), "/%016llx.gast", (unsigned long long) hash);
+    REQUIRE(parse() == 0);
+    int check;
+    std::string code = compile(false, &check);
+    REQUIRE(check == 0);
+    REQUIRE(count(code, "\ni2i ") == 1);
+    REQUIRE(save_cached_tree(context, directory, hash) == 0);
+    libera(context->tree);
+
+    // Rebuilt from the cache, x + 2 is still one node, computed once
+    scan_string(source);
+    REQUIRE(load_cached_tree(context, directory, hash) == 0);
+    Node* command = context->tree->next->next->value->function_decl_node.body->value->block_node.value;
+    Node* sum = command->value->attr_node.value;
+    REQUIRE(sum->shared);
+    REQUIRE(command->next->value->attr_node.value == sum);
+    Node* product = command->next->next->value->output_node.value->next;
+    REQUIRE(!product->shared);
+    REQUIRE(product->value->bin_op_node.left == sum);
+    REQUIRE(compile(false, &check) == code);
+    REQUIRE(check == 0);
+    std::string cached = read_file(directory + std::string(file));
+    REQUIRE(save_cached_tree(context, directory, hash) == 0);
+    REQUIRE(read_file(directory + std::string(file)) == cached);
+    libera(context->tree);
+
+    // A tree is only rebuilt in the mode it was saved in
+    share_expressions(&context->arena, false);
+    scan_string(source);
+    REQUIRE(load_cached_tree(context, directory, hash) == -1);
+    REQUIRE(parse() == 0);
+    REQUIRE(save_cached_tree(context, directory, hash) == 0);
+    libera(context->tree);
+    share_expressions(&context->arena, true);
+    scan_string(source);
+    REQUIRE(load_cached_tree(context, directory, hash) == -1);
+    release_source(context);
+    share_expressions(&context->arena, false);
+
+    unlink((directory + std::string(file)).c_str());
+    rmdir(directory);
+}
+
+TEST_CASE("Checked and compiled in one walk")
+{
+    scan_string("a int; b[3] int;\n"
+                "int f(int p) { int x <= a; x = -x * (a + 2) - b[1];\n"
+                "  if (x > 1 && !(a < 2)) then { x = 1; } else { a = x; };\n"
+                "  while (x < 10 || a == 0) do { x = x + 1; output x; };\n"
+                "  do { a = a - 1; } while (a > 0);\n"
+                "  return f(x);\n"
+                "}\n"
+                "int g() { int x <= 2; a = x % 3 + 4 / x; }\n");
+    REQUIRE(parse() == 0);
+    int check;
+    std::string two_pass = compile(false, &check);
+    REQUIRE(check == 0);
+    REQUIRE(count(two_pass, "\nstoreAI ") == 8);
+    REQUIRE(compile(true, &check) == two_pass);
+    REQUIRE(check == 0);
+    libera(context->tree);
+
+    // No code for a wrong program, even for what comes before the error
+    scan_string("a int; int f() { a = 1; a = c; }");
+    REQUIRE(parse() == 0);
+    two_pass = compile(false, &check);
+    REQUIRE(check == ERR_UNDECLARED);
+    REQUIRE(compile(true, &check) == two_pass);
+    REQUIRE(check == ERR_UNDECLARED);
+    REQUIRE(two_pass == "Semantic error: Identifier not declared\n");
+    libera(context->tree);
+}
+
+// What the stages of pipeline.c do with each declaration, one at a time
+static void check_and_generate(Node* declaration, void* data) {
+    if (check_declaration(declaration, static_cast<SymbolsTable*>(data)) == 0)
+        generate_declaration(declaration);
+}
+
+TEST_CASE("Pipelined like the sequential driver after a syntax error")
+{
+    // Errors in a body are recovered from, and the function rebuilt
+    const char* sources[] = {
+        "a int; int f() { int x <= 1; a = ; a = x; } int g() { a = 2; }",
+        "a int; int f() { a = 1 } int g() { int y <= a; }",
+    };
+    for (const char* source : sources) {
+        scan_string(source);
+        std::string sequential;
+        {
+            CaptureStdout capture;
+            if (parse() == 0 && check_program(context->tree, &context->source) == 0)
+                generate_code(context->tree);
+            sequential = capture.text();
+        }
+        libera(context->tree);
+
+        reg_counter = label_counter = global_offset = local_offset = 0;
+        global_memory = NULL;
+        SymbolsTable* table = createTable();
+        context->declaration_parsed = check_and_generate;
+        context->declaration_data = table;
+        scan_string(source);
+        std::string pipelined;
+        {
+            CaptureStdout capture;
+            REQUIRE(parse() == 1);
+            pipelined = capture.text();
+        }
+        REQUIRE(pipelined == sequential);
+        context->declaration_parsed = NULL;
+        context->declaration_data = NULL;
+        delete_table(table);
+        libera(context->tree);
+    }
+}
+
+TEST_CASE("Decompiled into a buffer")
+{
+    scan_string("a float; int f(float y) { float x <= 0.0078125;"
+                " output -2.5, 0.1, 1234567.0, 7; x = y * 16777216.0; }");
+    REQUIRE(parse() == 0);
+    std::string body = "{\n"
+                       "\tfloat x <= 0.007812;\n"
+                       "\toutput (-2.500000), 0.100000, 1234567.000000, 7;\n"
+                       "\tx = (y * 16777216.000000);\n"
+                       "}";
+    {
+        CaptureStdout capture;
+        print(context->tree);
+        REQUIRE(capture.text() == "a float;\n\nint f(float y) " + body);
+    }
+
+    // The caller's storage is used while the text fits, and is never freed
+    Node* function = context->tree->next;
+    Node* init = function->value->function_decl_node.body->value->block_node.value
+        ->value->local_var_node.init;
+    char storage[16];
+    PrintBuffer buffer = {storage, 0, sizeof(storage), false};
+    print_to(&buffer, init);
+    REQUIRE(buffer.data == storage);
+    REQUIRE(std::string(buffer.data, buffer.length) == "0.007812");
+
+    buffer.length = 0;
+    print_to(&buffer, function->value->function_decl_node.body);
+    REQUIRE(buffer.owned);
+    REQUIRE(buffer.data != storage);
+    REQUIRE(std::string(buffer.data, buffer.length) == body);
+    free_buffer(&buffer);
+    libera(context->tree);
+}
+
+// A symbol for a variable, as the checker makes them
+static Symbol* variable(SymbolsTable* table) {
+    Symbol* symbol = newSymbol(table);
+    symbol->nature = NAT_VARIABLE;
+    return symbol;
+}
+
+TEST_CASE("Symbols in nested scopes")
+{
+    Atom x = intern_str("x"), y = intern_str("y");
+    SymbolsTable* table = createTable();
+    Symbol* global_x = variable(table);
+    addSymbol(table, x, global_x);
+    REQUIRE(getSymbol(table, x) == global_x);
+    REQUIRE(getSymbolCurrentScope(table, x) == global_x);
+    REQUIRE(getSymbol(table, y) == NULL);
+
+    pushScope(table);
+    REQUIRE(getSymbol(table, x) == global_x);
+    REQUIRE(getSymbolCurrentScope(table, x) == NULL);
+    Symbol* local_x = variable(table);
+    addSymbol(table, x, local_x);
+    pushScope(table);
+    Symbol* inner_y = variable(table);
+    addSymbol(table, y, inner_y);
+    REQUIRE(getSymbol(table, x) == local_x);
+    REQUIRE(getSymbol(table, y) == inner_y);
+    popScope(table);
+    REQUIRE(getSymbol(table, y) == NULL);
+    // Its symbol went with it
+    REQUIRE(variable(table) == inner_y);
+    REQUIRE(getSymbolCurrentScope(table, x) == local_x);
+    popScope(table);
+    REQUIRE(getSymbol(table, x) == global_x);
+
+    // Enough names to grow the table a few times, all still found
+    std::vector<Atom> names;
+    for (int i = 0; i < 1000; i++) {
+        names.push_back(intern_str(("g" + std::to_string(i)).c_str()));
+        addSymbol(table, names.back(), variable(table));
+    }
+    for (Atom name : names)
+        REQUIRE(getSymbolCurrentScope(table, name) != NULL);
+    REQUIRE(getSymbol(table, x) == global_x);
+    delete_table(table);
+
+    // The id of a foreach goes with the loop's scope
+    scan_string("int f() { foreach (i : 1, 2) { output i; }; }");
+    REQUIRE(parse() == 0);
+    Node* loop = context->tree->value->function_decl_node.body->value->block_node.value;
+    REQUIRE(loop->type == FOR_EACH);
+    table = createTable();
+    pushScope(table);
+    Symbol* next = newSymbol(table);
+    popScope(table);
+    pushScope(table);
+    TypeNode type;
+    REQUIRE(typecheck(loop, table, &type) == 0);
+    REQUIRE(getSymbol(table, intern_str("i")) == NULL);
+    REQUIRE(newSymbol(table) == next);
+    popScope(table);
+    delete_table(table);
+    libera(context->tree);
+}
+
+TEST_CASE("Class layouts")
+{
+    scan_string("class Mixed [ int a : float b : char c : int a ];");
+    REQUIRE(parse() == 0);
+    SymbolsTable* table = createTable();
+    ClassLayout* layout = newLayout(table, context->tree->value->type_decl_node.field);
+    REQUIRE(layout->size == 17);
+    REQUIRE(findField(layout, intern_str("b"))->offset == 4);
+    REQUIRE(findField(layout, intern_str("c"))->offset == 12);
+    // The second a hides the first
+    REQUIRE(findField(layout, intern_str("a"))->offset == 13);
+    REQUIRE(findField(layout, intern_str("d")) == NULL);
+    delete_table(table);
+    libera(context->tree);
+
+    std::string source = "class Wide [ int f0";
+    for (int i = 1; i < 500; i++)
+        source += " : int f" + std::to_string(i);
+    source += " ]; w Wide; int g() { w$f499 = w$f0 + w$f250; }";
+    scan_string(source.c_str());
+    REQUIRE(parse() == 0);
+    {
+        DiscardStdout discard;
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+    }
+    libera(context->tree);
+
+    scan_string("class Wide [ int f0 : int f1 ]; w Wide; int g() { w$f2 = 1; }");
+    REQUIRE(parse() == 0);
+    {
+        DiscardStdout discard;
+        REQUIRE(check_program(context->tree, &context->source) == ERR_UNDECLARED);
+    }
+    libera(context->tree);
+}
+
+TEST_CASE("One node per type")
+{
+    scan_string("class Pair [ int a : int b ]; p Pair; q Pair; x int;"
+                " int f(Pair r, int y) { Pair s; s$a = y; }");
+    REQUIRE(parse() == 0);
+    Node* p = context->tree->next;
+    Node* x = p->next->next;
+    ParamNode* param = x->next->value->function_decl_node.param;
+    TypeNode* pair = p->value->global_var_node.type;
+    REQUIRE(p->next->value->global_var_node.type == pair);
+    REQUIRE(param->type == pair);
+    REQUIRE(param->next->type == x->value->global_var_node.type);
+    REQUIRE(x->value->global_var_node.type == make_type(INT_T, NULL));
+
+    {
+        DiscardStdout discard;
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+        REQUIRE(check_program(context->tree, &context->source) == 0);
+    }
+    // The size found by those checks is theirs only
+    SymbolsTable* table = createTable();
+    REQUIRE(size_for_type(pair, table) == -1);
+
+    // A local hiding the class is what the name stands for while it lives
+    Symbol* type = newSymbol(table);
+    type->nature = NAT_CLASS;
+    type->size = 8;
+    addSymbol(table, intern_str("Pair"), type);
+    REQUIRE(size_for_type(pair, table) == 8);
+    pushScope(table);
+    Symbol* local = newSymbol(table);
+    local->nature = NAT_VARIABLE;
+    local->size = 4;
+    addSymbol(table, intern_str("Pair"), local);
+    REQUIRE(size_for_type(pair, table) == 4);
+    popScope(table);
+    REQUIRE(table->hidden_classes == 0);
+    // Then the size is remembered again, without looking the class up
+    type->size = 16;
+    REQUIRE(size_for_type(pair, table) == 8);
+    delete_table(table);
+    libera(context->tree);
+}
+
+TEST_CASE("Variables numbered after their storage")
+{
+    const char* source = "a int; int f() { int b <= a; b = a + b; } int g() { int a <= 1; a = a * 2; }";
+    scan_string(source);
+    REQUIRE(parse() == 0);
+    // Looked up by name, as nothing is numbered yet
+    reg_counter = label_counter = global_offset = local_offset = 0;
+    global_memory = NULL;
+    std::string by_name;
+    {
+        CaptureStdout capture;
+        generate_code(context->tree);
+        by_name = capture.text();
+    }
+    int check;
+    REQUIRE(compile(false, &check) == by_name);
+    REQUIRE(check == 0);
+
+    Node* a = context->tree;
+    Node* f = a->next->value->function_decl_node.body->value->block_node.value;
+    Node* g = a->next->next->value->function_decl_node.body->value->block_node.value;
+    REQUIRE(a->value->global_var_node.storage == 1);
+    REQUIRE(f->value->local_var_node.storage == 2);
+    REQUIRE(f->value->local_var_node.init->value->var_node.storage == 1);
+    // b = a + b
+    AttrNode attr = f->next->value->attr_node;
+    REQUIRE(attr.var->storage == 2);
+    REQUIRE(attr.value->value->bin_op_node.left->value->var_node.storage == 1);
+    REQUIRE(attr.value->value->bin_op_node.right->value->var_node.storage == 2);
+    // The local a of g hides the global one
+    REQUIRE(g->value->local_var_node.storage == 3);
+    REQUIRE(g->next->value->attr_node.var->storage == 3);
+    libera(context->tree);
+}
+
+TEST_CASE("Frames laid out per function")
+{
+    scan_string("a int;\n"
+                "int f() { int x <= 1;\n"
+                "  if (a > x) then { int y <= a; a = y; } else { int z <= 2; a = z; };\n"
+                "  int keep <= 5;\n"
+                "  while (a < 9) do { a = a + keep; int n <= a; a = n * 2; };\n"
+                "}\n"
+                "int g() { float w <= 1.5; int i <= 3; a = i; }\n");
+    REQUIRE(parse() == 0);
+    int check;
+    std::string code = compile(false, &check);
+    REQUIRE(check == 0);
+    REQUIRE(compile(true, &check) == code);
+    // x is dead once compared, so the locals of both branches and keep take
+    // its slot; keep is read again on the next turn of the loop, n is not
+    REQUIRE(code.find("// frame of f: 8 bytes\n") == 0);
+    REQUIRE(count(code.substr(0, code.find("// frame of g")), "=> rfp, 0 //") == 4);
+    REQUIRE(code.find("=> rfp, 4 // int n") != std::string::npos);
+    // Each function starts its own frame, with a float taking 8 bytes
+    REQUIRE(code.find("\n// frame of g: 12 bytes\n") != std::string::npos);
+    REQUIRE(code.find("=> rfp, 8 // int i") != std::string::npos);
+    libera(context->tree);
 }
@@ -1,202 +1,444 @@
 #include "catch.hpp"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
 
 extern "C" {
 #include "../parser.tab.h"
-#include "../lex.yy.h"
+#include "../lexer.h"
+#include "../intern.h"
+}
+
+static ParseContext* new_context() {
+    ParseContext* context = new ParseContext;
+    init_context(context);
+    return context;
+}
+
+// All scanner tests share one context
+static ParseContext* context = new_context();
+static YYSTYPE yylval;
+
+static void scan_string(const char* str) { scan_text(context, str, strlen(str)); }
+static int lex() { return yylex(&yylval, context->scanner); }
+static const char* text() { return yyget_text(context->scanner); }
+
+static std::string string_literal() {
+    StringNode literal = yylval.token.value.string_literal;
+    return std::string(literal.text, literal.length);
+}
+
+static int token_line() {
+    int line, column;
+    get_position(context, yylval.token.offset, &line, &column);
+    return line;
+}
+
+static int token_column() {
+    int line, column;
+    get_position(context, yylval.token.offset, &line, &column);
+    return column;
 }
 
 TEST_CASE("Reserved words")
 {
     SECTION("Types") {
-        yy_scan_string("int float bool char string");
-        REQUIRE(yylex() == TK_PR_INT);
-        REQUIRE(yylex() == TK_PR_FLOAT);
-        REQUIRE(yylex() == TK_PR_BOOL);
-        REQUIRE(yylex() == TK_PR_CHAR);
-        REQUIRE(yylex() == TK_PR_STRING);
+        scan_string("int float bool char string");
+        REQUIRE(lex() == TK_PR_INT);
+        REQUIRE(lex() == TK_PR_FLOAT);
+        REQUIRE(lex() == TK_PR_BOOL);
+        REQUIRE(lex() == TK_PR_CHAR);
+        REQUIRE(lex() == TK_PR_STRING);
     }
 
     SECTION ("Conditionals") {
-        yy_scan_string("if then else switch case");
-        REQUIRE(yylex() == TK_PR_IF);
-        REQUIRE(yylex() == TK_PR_THEN);
-        REQUIRE(yylex() == TK_PR_ELSE);
-        REQUIRE(yylex() == TK_PR_SWITCH);
-        REQUIRE(yylex() == TK_PR_CASE);
+        scan_string("if then else switch case");
+        REQUIRE(lex() == TK_PR_IF);
+        REQUIRE(lex() == TK_PR_THEN);
+        REQUIRE(lex() == TK_PR_ELSE);
+        REQUIRE(lex() == TK_PR_SWITCH);
+        REQUIRE(lex() == TK_PR_CASE);
     }
 
     SECTION ("Loop control") {
-        yy_scan_string("while for foreach continue break");
-        REQUIRE(yylex() == TK_PR_WHILE);
-        REQUIRE(yylex() == TK_PR_FOR);
-        REQUIRE(yylex() == TK_PR_FOREACH);
-        REQUIRE(yylex() == TK_PR_CONTINUE);
-        REQUIRE(yylex() == TK_PR_BREAK);
+        scan_string("while for foreach continue break");
+        REQUIRE(lex() == TK_PR_WHILE);
+        REQUIRE(lex() == TK_PR_FOR);
+        REQUIRE(lex() == TK_PR_FOREACH);
+        REQUIRE(lex() == TK_PR_CONTINUE);
+        REQUIRE(lex() == TK_PR_BREAK);
     }
 
     SECTION ("Access modifiers") {
-        yy_scan_string("public protected private");
-        REQUIRE(yylex() == TK_PR_PUBLIC);
-        REQUIRE(yylex() == TK_PR_PROTECTED);
-        REQUIRE(yylex() == TK_PR_PRIVATE);
+        scan_string("public protected private");
+        REQUIRE(lex() == TK_PR_PUBLIC);
+        REQUIRE(lex() == TK_PR_PROTECTED);
+        REQUIRE(lex() == TK_PR_PRIVATE);
     }
 
     SECTION ("Other") {
-        yy_scan_string("input output return const static class");
-        REQUIRE(yylex() == TK_PR_INPUT);
-        REQUIRE(yylex() == TK_PR_OUTPUT);
-        REQUIRE(yylex() == TK_PR_RETURN);
-        REQUIRE(yylex() == TK_PR_CONST);
-        REQUIRE(yylex() == TK_PR_STATIC);
-        REQUIRE(yylex() == TK_PR_CLASS);
+        scan_string("input output return const static class");
+        REQUIRE(lex() == TK_PR_INPUT);
+        REQUIRE(lex() == TK_PR_OUTPUT);
+        REQUIRE(lex() == TK_PR_RETURN);
+        REQUIRE(lex() == TK_PR_CONST);
+        REQUIRE(lex() == TK_PR_STATIC);
+        REQUIRE(lex() == TK_PR_CLASS);
     }
 }
 
 TEST_CASE ("Special characters") {
     std::string special(",;:()[]{}+-|?*/=<>!&%#^.$");
-    yy_scan_string(special.data());
+    scan_string(special.data());
     for (int i = 0; i < special.length(); i++)
     {
-        REQUIRE(yylex() == special.at(i));
+        REQUIRE(lex() == special.at(i));
     }
 }
 
 TEST_CASE("Identifiers")
 {
-    yy_scan_string("intx xint _int int_ int7 int7x");
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
-    REQUIRE(yylex() == TK_IDENTIFICADOR);
+    scan_string("intx xint _int int_ int7 int7x");
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+
+    scan_string("7int");
+    REQUIRE(lex() != TK_IDENTIFICADOR);
+    REQUIRE(lex() != TK_IDENTIFICADOR);
+}
 
-    yy_scan_string("7int");
-    REQUIRE(yylex() != TK_IDENTIFICADOR);
-    REQUIRE(yylex() != TK_IDENTIFICADOR);
+TEST_CASE("Interned names")
+{
+    scan_string("total _n total totals _n");
+    std::vector<Atom> names;
+    while (lex() == TK_IDENTIFICADOR)
+        names.push_back(yylval.token.value.identifier);
+    REQUIRE(names.size() == 5);
+    REQUIRE(names[0] == names[2]);
+    REQUIRE(names[1] == names[4]);
+    REQUIRE(names[0] != names[1]);
+    REQUIRE(names[0] != names[3]);
+    REQUIRE(names[0] == intern_str("total"));
+    REQUIRE(atom_length(names[3]) == 6);
+    REQUIRE(std::string(names[3]) == "totals");
+
+    // Literals of the source are views into it; those of any other buffer
+    // are interned
+    YY_BUFFER_STATE buffer = yy_scan_string("\"hi\" \"hi\" \"hi!\" \"\"", context->scanner);
+    std::vector<const char*> literals;
+    while (lex() == TK_LIT_STRING)
+        literals.push_back(yylval.token.value.string_literal.text);
+    yy_delete_buffer(buffer, context->scanner);
+    REQUIRE(literals.size() == 4);
+    REQUIRE(literals[0] == literals[1]);
+    REQUIRE(literals[0] != literals[2]);
+    REQUIRE(literals[0] == intern("hi!", 2));
+    REQUIRE(literals[2] == intern_str("hi!"));
+    REQUIRE(literals[3] == intern_str(""));
+    REQUIRE(literals[3] != literals[0]);
 }
 
 TEST_CASE("Literals")
 {
     SECTION("Int") {
-        yy_scan_string("207");
-        REQUIRE(yylex() == TK_LIT_INT);
-        REQUIRE(std::string(yytext) == "207");
-
-        yy_scan_string("+207");
-        REQUIRE(yylex() == '+');
-        REQUIRE(yylex() == TK_LIT_INT);
-        REQUIRE(std::string(yytext) == "207");
-
-        yy_scan_string("-207");
-        REQUIRE(yylex() == '-');
-        REQUIRE(yylex() == TK_LIT_INT);
-        REQUIRE(std::string(yytext) == "207");
+        scan_string("207");
+        REQUIRE(lex() == TK_LIT_INT);
+        REQUIRE(std::string(text()) == "207");
+
+        scan_string("+207");
+        REQUIRE(lex() == '+');
+        REQUIRE(lex() == TK_LIT_INT);
+        REQUIRE(std::string(text()) == "207");
+
+        scan_string("-207");
+        REQUIRE(lex() == '-');
+        REQUIRE(lex() == TK_LIT_INT);
+        REQUIRE(std::string(text()) == "207");
     }
 
     SECTION("Float") {
-        yy_scan_string("2.07");
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07");
-
-        yy_scan_string("+2.07");
-        REQUIRE(yylex() == '+');
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07");
-
-        yy_scan_string("-2.07");
-        REQUIRE(yylex() == '-');
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07");
-
-        yy_scan_string("2.07e33");
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07e33");
-
-        yy_scan_string("2.07e-33");
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07e-33");
-
-        yy_scan_string("-2.07E+33");
-        REQUIRE(yylex() == '-');
-        REQUIRE(yylex() == TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) == "2.07E+33");
-
-        yy_scan_string("2.");
-        REQUIRE(yylex() != TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) != "2.07");
-
-        yy_scan_string(".07");
-        REQUIRE(yylex() != TK_LIT_FLOAT);
-        REQUIRE(std::string(yytext) != "2.07");
+        scan_string("2.07");
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07");
+
+        scan_string("+2.07");
+        REQUIRE(lex() == '+');
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07");
+
+        scan_string("-2.07");
+        REQUIRE(lex() == '-');
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07");
+
+        scan_string("2.07e33");
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07e33");
+
+        scan_string("2.07e-33");
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07e-33");
+
+        scan_string("-2.07E+33");
+        REQUIRE(lex() == '-');
+        REQUIRE(lex() == TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) == "2.07E+33");
+
+        scan_string("2.");
+        REQUIRE(lex() != TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) != "2.07");
+
+        scan_string(".07");
+        REQUIRE(lex() != TK_LIT_FLOAT);
+        REQUIRE(std::string(text()) != "2.07");
     }
 
     SECTION("Bool") {
-        yy_scan_string("true");
-        REQUIRE(yylex() == TK_LIT_TRUE);
-        REQUIRE(std::string(yytext) == "true");
+        scan_string("true");
+        REQUIRE(lex() == TK_LIT_TRUE);
+        REQUIRE(std::string(text()) == "true");
 
-        yy_scan_string("false");
-        REQUIRE(yylex() == TK_LIT_FALSE);
-        REQUIRE(std::string(yytext) == "false");
+        scan_string("false");
+        REQUIRE(lex() == TK_LIT_FALSE);
+        REQUIRE(std::string(text()) == "false");
 
-        yy_scan_string("True");
-        REQUIRE(yylex() != TK_LIT_TRUE);
-        REQUIRE(std::string(yytext) == "True");
+        scan_string("True");
+        REQUIRE(lex() != TK_LIT_TRUE);
+        REQUIRE(std::string(text()) == "True");
     }
 
     SECTION("Char") {
-        yy_scan_string("'a'");
-        REQUIRE(yylex() == TK_LIT_CHAR);
-        REQUIRE(std::string(yytext) == "'a'");
+        scan_string("'a'");
+        REQUIRE(lex() == TK_LIT_CHAR);
+        REQUIRE(std::string(text()) == "'a'");
 
-        yy_scan_string("' '");
-        REQUIRE(yylex() == TK_LIT_CHAR);
-        REQUIRE(std::string(yytext) == "' '");
+        scan_string("' '");
+        REQUIRE(lex() == TK_LIT_CHAR);
+        REQUIRE(std::string(text()) == "' '");
 
-        yy_scan_string("''");
-        REQUIRE(yylex() != TK_LIT_CHAR);
-        REQUIRE(std::string(yytext) != "''");
+        scan_string("''");
+        REQUIRE(lex() != TK_LIT_CHAR);
+        REQUIRE(std::string(text()) != "''");
 
-        yy_scan_string("'\\t'");
-        REQUIRE(yylex() != TK_LIT_CHAR);
-        REQUIRE(std::string(yytext) != "'\\t'");
+        scan_string("'\\t'");
+        REQUIRE(lex() != TK_LIT_CHAR);
+        REQUIRE(std::string(text()) != "'\\t'");
     }
 
     SECTION("String") {
         SECTION("Regular") {
-            yy_scan_string("\"abc\"");
-            REQUIRE(yylex() == TK_LIT_STRING);
-            REQUIRE(std::string(yytext) == "\"abc\"");
+            scan_string("\"abc\"");
+            REQUIRE(lex() == TK_LIT_STRING);
+            REQUIRE(std::string(text()) == "\"abc\"");
+            REQUIRE(yylval.token.value.string_literal.length == 3);
         }
 
         SECTION("Empty") {
-            yy_scan_string("\"\"");
-            REQUIRE(yylex() == TK_LIT_STRING);
-            REQUIRE(std::string(yytext) == "\"\"");
+            scan_string("\"\"");
+            REQUIRE(lex() == TK_LIT_STRING);
+            REQUIRE(std::string(text()) == "\"\"");
+            REQUIRE(yylval.token.value.string_literal.length == 0);
         }
     }
 }
 
 TEST_CASE("Error token") {
-    yy_scan_string("'abc'");
-    REQUIRE(yylex() == TOKEN_ERRO);
+    scan_string("'abc'");
+    REQUIRE(lex() == TOKEN_ERRO);
 }
 
 TEST_CASE("Comments") {
     SECTION("Line comment"){
-        yy_scan_string("int// ignore this \nfloat");
-        REQUIRE(yylex() == TK_PR_INT);
-        REQUIRE(std::string(yytext) == "int");
-        REQUIRE(yylex() == TK_PR_FLOAT);
-        REQUIRE(std::string(yytext) == "float");
+        scan_string("int// ignore this \nfloat");
+        REQUIRE(lex() == TK_PR_INT);
+        REQUIRE(std::string(text()) == "int");
+        REQUIRE(lex() == TK_PR_FLOAT);
+        REQUIRE(std::string(text()) == "float");
     }
 
     SECTION("Block comment"){
-        yy_scan_string("int/* ignore this\nand this\n*/float");
-        REQUIRE(yylex() == TK_PR_INT);
-        REQUIRE(std::string(yytext) == "int");
-        REQUIRE(yylex() == TK_PR_FLOAT);
-        REQUIRE(std::string(yytext) == "float");
+        scan_string("int/* ignore this\nand this\n*/float");
+        REQUIRE(lex() == TK_PR_INT);
+        REQUIRE(std::string(text()) == "int");
+        REQUIRE(lex() == TK_PR_FLOAT);
+        REQUIRE(std::string(text()) == "float");
+    }
+}
+
+TEST_CASE("Token positions") {
+    scan_string("\nint /* a\n**b */  x\n\t// c\n  'c' @ y");
+    REQUIRE(lex() == TK_PR_INT);
+    int line = token_line();
+    REQUIRE(token_column() == 1);
+
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(token_line() == line + 1);
+    REQUIRE(token_column() == 9);
+
+    REQUIRE(lex() == TK_LIT_CHAR);
+    REQUIRE(token_line() == line + 3);
+    REQUIRE(token_column() == 3);
+
+    // Invalid characters do not count towards the column
+    REQUIRE(lex() == TOKEN_ERRO);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(token_column() == 8);
+}
+
+TEST_CASE("Mapped input") {
+    char path[] = "/tmp/scanner_testXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    std::string source("x \"abc\" \"\" y");
+    REQUIRE(write(fd, source.data(), source.size()) == (ssize_t) source.size());
+    close(fd);
+
+    REQUIRE(scan_file(context, path) == 0);
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == TK_LIT_STRING);
+    REQUIRE(string_literal() == "abc");
+    REQUIRE(yylval.token.value.string_literal.length == 3);
+    REQUIRE(lex() == TK_LIT_STRING);
+    REQUIRE(string_literal() == "");
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(lex() == 0);
+    release_source(context);
+    unlink(path);
+
+    REQUIRE(scan_file(context, "/nonexistent/file") == -1);
+}
+
+TEST_CASE("Long lexemes") {
+    // Longer than any block the lexer classifies at once
+    std::string id(100, 'a');
+    std::string spaces(70, ' ');
+    std::string comment = "/*" + std::string(80, '*') + "\n" + std::string(40, '/') + "*/";
+    std::string source = "\n" + spaces + id + "\n" + comment + "\"" + id + "\"" + spaces + "\n\n7";
+    scan_string(source.c_str());
+
+    REQUIRE(lex() == TK_IDENTIFICADOR);
+    REQUIRE(std::string(text()) == id);
+    int line = token_line();
+    REQUIRE(token_column() == 71);
+
+    REQUIRE(lex() == TK_LIT_STRING);
+    REQUIRE(string_literal() == id);
+    REQUIRE(token_line() == line + 2);
+    REQUIRE(token_column() == 43);
+
+    REQUIRE(lex() == TK_LIT_INT);
+    REQUIRE(token_line() == line + 4);
+    REQUIRE(token_column() == 1);
+    REQUIRE(lex() == 0);
+}
+
+// Tokens without a value leave the previous one in yylval
+static bool has_value(int type) {
+    switch (type) {
+        case TOKEN_ERRO: case TK_OC_SL: case TK_OC_SR:
+        case TK_PR_IF: case TK_PR_THEN: case TK_PR_ELSE: case TK_PR_WHILE:
+        case TK_PR_DO: case TK_PR_INPUT: case TK_PR_OUTPUT: case TK_PR_RETURN:
+        case TK_PR_CONST: case TK_PR_STATIC: case TK_PR_FOREACH: case TK_PR_FOR:
+        case TK_PR_SWITCH: case TK_PR_CASE: case TK_PR_BREAK: case TK_PR_CONTINUE:
+        case TK_PR_CLASS:
+            return false;
+        default:
+            return true;
     }
 }
+
+TEST_CASE("Parallel pre-lexing") {
+    std::string unit =
+        "int f(int n) { // a \"line\" comment /*\n"
+        "  string s <= \"not /* a comment\"; char c <= '\"';\n"
+        "  output 3.25e2, n %>% g, 'x' @ 7;\n"
+        "}\n";
+    std::string source;
+    while (source.size() < (1 << 20))
+        source += unit;
+    // Block comments spanning several chunks, and one the source ends in
+    source += "/*" + std::string(1 << 20, '\n') + "*/ x\n";
+    while (source.size() < (3 << 20))
+        source += unit;
+    source += "/* " + std::string(600 << 10, '*') + "\n\n */ y /* never closed\n";
+
+    struct Lexed { int type; uint32_t end; Token token; std::string literal; };
+    std::vector<Lexed> expected;
+    scan_string(source.c_str());
+    int type;
+    do {
+        type = lex();
+        expected.push_back({ type, context->scan_offset, yylval.token, type == TK_LIT_STRING ? string_literal() : "" });
+    } while (type != 0);
+    size_t skipped = context->source.skipped_count;
+
+    scan_string(source.c_str());
+    prelex(context, 8);
+    REQUIRE(context->token_count == expected.size());
+    REQUIRE(context->source.skipped_count == skipped);
+    for (size_t i = 0; i < expected.size(); i++) {
+        LexedToken t = context->tokens[i];
+        REQUIRE(t.type == expected[i].type);
+        REQUIRE(t.end == expected[i].end);
+        if (t.type == 0)
+            break;
+        REQUIRE(t.token.offset == expected[i].token.offset);
+        if (!has_value(t.type))
+            continue;
+        REQUIRE(t.token.category == expected[i].token.category);
+        TokenValue a = t.token.value, b = expected[i].token.value;
+        switch (t.token.category) {
+            case TYPE_KEYWORD: REQUIRE(a.type_keyword == b.type_keyword); break;
+            case SCOPE_KEYWORD: REQUIRE(a.scope == b.scope); break;
+            case SPECIAL_CHAR: REQUIRE(a.special_char == b.special_char); break;
+            case BINARY_OPERATOR: REQUIRE(a.binary_operator == b.binary_operator); break;
+            case IDENTIFIER: REQUIRE(a.identifier == b.identifier); break;
+            case INT_LITERAL: REQUIRE(a.int_literal == b.int_literal); break;
+            case FLOAT_LITERAL: REQUIRE(a.float_literal == b.float_literal); break;
+            case CHAR_LITERAL: REQUIRE(a.char_literal == b.char_literal); break;
+            case BOOL_LITERAL: REQUIRE(a.bool_literal == b.bool_literal); break;
+            case STRING_LITERAL:
+                REQUIRE(std::string(a.string_literal.text, a.string_literal.length) == expected[i].literal);
+                break;
+        }
+    }
+}
+
+// Run with `make bench`, once per scanner backend
+TEST_CASE("Scanner throughput", "[.][benchmark]") {
+    std::string unit =
+        "int fibonacci(int n) {\n"
+        "  // iterative version\n"
+        "  int a <= 0; int b <= 1;\n"
+        "  /* the loop keeps\n     two terms */\n"
+        "  while (n > 0) do { int t <= a + b; a = b; b = t; n = n - 1; };\n"
+        "  output \"done\", 3.25e2;\n"
+        "  return a;\n"
+        "}\n";
+    std::string source;
+    while (source.size() < (32 << 20))
+        source += unit;
+
+    char path[] = "/tmp/scanner_benchXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, source.data(), source.size()) == (ssize_t) source.size());
+    close(fd);
+
+    REQUIRE(scan_file(context, path) == 0);
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = 0;
+    while (lex() != 0)
+        tokens++;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    release_source(context);
+    unlink(path);
+
+    WARN(tokens << " tokens, " << source.size() / elapsed.count() / (1 << 20) << " MB/s");
+}
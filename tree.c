@@ -1,187 +1,366 @@
 #include "tree.h"
 #include <string.h>
 
+// Arena allocation
+//
+// Chunks are aligned on their size, so the chunk, and the arena, any node
+// belongs to is found from its address alone.
+
+#define CHUNK_SIZE ((size_t) 1 << 20)
+// No AST structure needs more than pointer alignment
+#define ALIGNMENT sizeof(void*)
+
+typedef struct ArenaChunk {
+  struct ArenaChunk* previous;
+  Arena* arena;
+} ArenaChunk;
+
+// Used by threads that never selected an arena
+static __thread Arena default_arena;
+static __thread Arena* current_arena = NULL;
+
+void init_arena(Arena* arena) {
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->share = false;
+  arena->shared = NULL;
+  arena->shared_count = 0;
+  arena->shared_capacity = 0;
+  arena->types = NULL;
+  arena->type_count = 0;
+  arena->type_capacity = 0;
+}
+
+void free_arena(Arena* arena) {
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk != NULL) {
+    ArenaChunk* previous = chunk->previous;
+    free(chunk);
+    chunk = previous;
+  }
+  arena->chunks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  free(arena->shared);
+  arena->shared = NULL;
+  arena->shared_count = 0;
+  arena->shared_capacity = 0;
+  free(arena->types);
+  arena->types = NULL;
+  arena->type_count = 0;
+  arena->type_capacity = 0;
+}
+
+void use_arena(Arena* arena) {
+  current_arena = arena;
+}
+
+void share_expressions(Arena* arena, bool share) {
+  arena->share = share;
+}
+
+static void* new_chunk(Arena* arena, size_t size) {
+  // Larger allocations get a chunk of their own: they still start within
+  // the first CHUNK_SIZE bytes of it
+  size_t chunk_size = CHUNK_SIZE;
+  if (size > CHUNK_SIZE - sizeof(ArenaChunk))
+    chunk_size = (size + sizeof(ArenaChunk) + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+  ArenaChunk* chunk = aligned_alloc(CHUNK_SIZE, chunk_size);
+  if (chunk == NULL) {
+    perror("aligned_alloc");
+    exit(1);
+  }
+  chunk->previous = arena->chunks;
+  chunk->arena = arena;
+  arena->chunks = chunk;
+  arena->next = (char*) (chunk + 1) + size;
+  arena->end = (char*) chunk + chunk_size;
+  return chunk + 1;
+}
+
+static Arena* arena_in_use() {
+  return current_arena != NULL ? current_arena : &default_arena;
+}
+
+static void* allocate(size_t size) {
+  Arena* arena = arena_in_use();
+  size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  if ((size_t) (arena->end - arena->next) < size)
+    return new_chunk(arena, size);
+  void* p = arena->next;
+  arena->next += size;
+  return p;
+}
+
 // Private functions
 
+// Bytes of the value of each kind of node: a literal does not pay for the
+// largest member of the union
+static const size_t value_size[] = {
+  [INT] = sizeof(int),
+  [FLOAT] = sizeof(float),
+  [BOOL] = sizeof(bool),
+  [CHAR] = sizeof(char),
+  [STRING] = sizeof(StringNode),
+  [VARIABLE] = sizeof(VariableNode),
+  [BIN_OP] = sizeof(BinOpNode),
+  [UN_OP] = sizeof(UnOpNode),
+  [TERN_OP] = sizeof(TernOpNode),
+  [TYPE_DECL] = sizeof(TypeDeclNode),
+  [GLOBAL_VAR_DECL] = sizeof(GlobalVarNode),
+  [FUNCTION_DECL] = sizeof(FunctionDeclNode),
+  [VAR_DECL] = sizeof(LocalVarNode),
+  [ATTR] = sizeof(AttrNode),
+  [SHIFT_L] = sizeof(AttrNode),
+  [SHIFT_R] = sizeof(AttrNode),
+  [FUNCTION_CALL] = sizeof(FunctionCallNode),
+  [DOT] = 0,
+  [RETURN] = sizeof(ListNode),
+  [INPUT] = sizeof(ListNode),
+  [OUTPUT] = sizeof(ListNode),
+  [BREAK] = 0,
+  [CONTINUE] = 0,
+  [CASE] = sizeof(int),
+  [BLOCK] = sizeof(ListNode),
+  [IF] = sizeof(IfNode),
+  [WHILE] = sizeof(WhileNode),
+  [DO_WHILE] = sizeof(WhileNode),
+  [SWITCH] = sizeof(SwitchNode),
+  [FOR] = sizeof(ForNode),
+  [FOR_EACH] = sizeof(ForEachNode),
+};
+
 Node* make_node(NodeType type) {
-  Node* n = (Node*) malloc(sizeof(Node));
+  Node* n = allocate(sizeof(Node) + value_size[type]);
   n->type = type;
   n->coerced_to = -1;
-  n->value = malloc(sizeof(union NodeValue));
+  n->shared = false;
   n->next = NULL;
-  n->line = 0;
-  n->column = 0;
+  n->offset = 0;
   return n;
 }
 
-void free_node(Node* node) {
-  free(node->value);
-  free(node);
+// Hash-consing
+//
+// Each side-effect-free expression is built once per arena: its nodes are
+// looked up by kind and value in an open addressing table, where operands
+// are compared by address since they are shared themselves. Since nodes
+// are only ever released with the whole arena, a node needs no count of
+// the parents it has.
+
+static size_t shared_hash(NodeType type, const union NodeValue* value) {
+  // FNV-1a over the value, whose padding the caller zeroes
+  uint64_t hash = 14695981039346656037ULL ^ type;
+  const unsigned char* bytes = (const unsigned char*) value;
+  for (size_t i = 0; i < value_size[type]; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
 }
 
-// Deletion Functions
+static void grow_shared(Arena* arena) {
+  size_t capacity = arena->shared_capacity == 0 ? 1024 : 2 * arena->shared_capacity;
+  Node** shared = calloc(capacity, sizeof(Node*));
+  for (size_t i = 0; i < arena->shared_capacity; i++) {
+    Node* node = arena->shared[i];
+    if (node == NULL)
+      continue;
+    size_t slot = shared_hash(node->type, node->value) & (capacity - 1);
+    while (shared[slot] != NULL)
+      slot = (slot + 1) & (capacity - 1);
+    shared[slot] = node;
+  }
+  free(arena->shared);
+  arena->shared = shared;
+  arena->shared_capacity = capacity;
+}
 
-void libera(Node* node) {
-  delete(node);
+// The node of the given kind and value, built the first time it is asked for
+static Node* make_shared(Arena* arena, NodeType type, const union NodeValue* value, uint32_t offset) {
+  if (2 * (arena->shared_count + 1) > arena->shared_capacity)
+    grow_shared(arena);
+  size_t mask = arena->shared_capacity - 1;
+  size_t slot = shared_hash(type, value) & mask;
+  for (Node* node; (node = arena->shared[slot]) != NULL; slot = (slot + 1) & mask)
+    if (node->type == type && memcmp(node->value, value, value_size[type]) == 0)
+      return node;
+
+  Node* n = make_node(type);
+  memcpy(n->value, value, value_size[type]);
+  n->offset = offset;
+  n->shared = true;
+  arena->shared[slot] = n;
+  arena->shared_count++;
+  return n;
 }
 
-void delete_type(TypeNode* type) {
-  if (type == NULL)
-    return;
-  if (type->name != NULL)
-    free(type->name);
-  free(type);
+Node* unshared(Node* node) {
+  if (node == NULL || !node->shared)
+    return node;
+  Node* n = make_node(node->type);
+  memcpy(n->value, node->value, value_size[node->type]);
+  n->offset = node->offset;
+  return n;
 }
 
-void delete_param(ParamNode* node) {
+// Deletion Functions
+
+// Releases the whole arena the tree was built in, without walking it.
+// Every other tree built in the same arena is released with it.
+void libera(Node* node) {
   if (node == NULL)
     return;
-  delete_type(node->type);
-  delete_param(node->next);
-  free(node->identifier);
-  free(node);
+  ArenaChunk* chunk = (ArenaChunk*) ((uintptr_t) node & ~(CHUNK_SIZE - 1));
+  free_arena(chunk->arena);
 }
 
-void delete_field(FieldNode* node) {
-  if (node == NULL)
-    return;
-  delete_type(node->type);
-  delete_field(node->next);
-  free(node->identifier);
-  free(node);
+// Node stacks
+
+void push_node(NodeStack* stack, Node* node) {
+  if (stack->count == stack->capacity) {
+    stack->capacity = stack->capacity == 0 ? 16 : 2 * stack->capacity;
+    stack->items = realloc(stack->items, stack->capacity * sizeof(Node*));
+  }
+  stack->items[stack->count++] = node;
 }
 
-void delete_var(VariableNode* var) {
-  free(var->identifier);
-  delete(var->index);
-  if (var->field != NULL)
-    free(var->field);
-  free(var);
+Node* pop_node(NodeStack* stack) {
+  return stack->items[--stack->count];
 }
 
-void delete(Node* node) {
-  if (node == NULL)
+void free_stack(NodeStack* stack) {
+  free(stack->items);
+  stack->items = NULL;
+  stack->count = 0;
+  stack->capacity = 0;
+}
+
+// Print Function
+
+// The decompiled text is put together in a buffer and written at once:
+// a call to printf per token costs more than the tokens themselves
+
+static void reserve(PrintBuffer* out, size_t size) {
+  if (out->length + size <= out->capacity)
     return;
-  // Type-specific internal frees
-  switch (node->type) {
-    case INT:
-    case FLOAT:
-    case BOOL:
-    case CHAR:
-      break;
-    case STRING:
-      free(node->value->string_node);
-      break;
-    case VARIABLE:
-      free(node->value->var_node.identifier);
-      delete(node->value->var_node.index);
-      if (node->value->var_node.field != NULL)
-        free(node->value->var_node.field);
-      break;
-    case BIN_OP:
-      delete(node->value->bin_op_node.left);
-      delete(node->value->bin_op_node.right);
-      break;
-    case UN_OP:
-      delete(node->value->un_op_node.value);
-      break;
-    case TERN_OP:
-      delete(node->value->tern_op_node.cond);
-      delete(node->value->tern_op_node.exp1);
-      delete(node->value->tern_op_node.exp2);
-      break;
-    case GLOBAL_VAR_DECL:
-      delete_type(node->value->global_var_node.type);
-      free(node->value->global_var_node.identifier);
-      break;
-    case TYPE_DECL:
-      free(node->value->type_decl_node.identifier);
-      delete_field(node->value->type_decl_node.field);
-      break;
-    case FUNCTION_DECL:
-      delete_type(node->value->function_decl_node.type);
-      free(node->value->function_decl_node.identifier);
-      delete_param(node->value->function_decl_node.param);
-      delete(node->value->function_decl_node.body);
-      break;
-    case VAR_DECL:
-      delete_type(node->value->local_var_node.type);
-      free(node->value->local_var_node.identifier);
-      delete(node->value->local_var_node.init);
-      break;
-    case ATTR:
-      delete_var(node->value->attr_node.var);
-      delete(node->value->attr_node.value);
-      break;
-    case SHIFT_L:
-      delete_var(node->value->shift_l_node.var);
-      delete(node->value->shift_l_node.value);
-      break;
-    case SHIFT_R:
-      delete_var(node->value->shift_r_node.var);
-      delete(node->value->shift_r_node.value);
-      break;
-    case FUNCTION_CALL:
-      free(node->value->function_call_node.identifier);
-      delete(node->value->function_call_node.arguments);
-      break;
-    case DOT:
-      break;
-    case RETURN:
-      delete(node->value->return_node.value);
-      break;
-    case BREAK:
-    case CONTINUE:
-    case CASE:
-      break;
-    case INPUT:
-      delete(node->value->input_node.value);
-      break;
-    case OUTPUT:
-      delete(node->value->output_node.value);
-      break;
-    case BLOCK:
-      delete(node->value->block_node.value);
-      break;
-    case IF:
-      delete(node->value->if_node.cond);
-      delete(node->value->if_node.then);
-      delete(node->value->if_node.else_node);
-      break;
-    case WHILE:
-      delete(node->value->while_node.cond);
-      delete(node->value->while_node.body);
-      break;
-    case DO_WHILE:
-      delete(node->value->do_while_node.cond);
-      delete(node->value->do_while_node.body);
-      break;
-    case SWITCH:
-      delete(node->value->switch_node.expression);
-      delete(node->value->switch_node.body);
-      break;
-    case FOR:
-      delete(node->value->for_node.initializers);
-      delete(node->value->for_node.expressions);
-      delete(node->value->for_node.commands);
-      delete(node->value->for_node.body);
-      break;
-    case FOR_EACH:
-      delete(node->value->for_each_node.expression);
-      delete(node->value->for_each_node.body);
-      free(node->value->for_each_node.id);
-      break;
+  size_t capacity = out->capacity == 0 ? 4096 : 2 * out->capacity;
+  while (capacity < out->length + size)
+    capacity *= 2;
+  if (out->owned || out->data == NULL) {
+    out->data = realloc(out->data, capacity);
+  } else {
+    // The caller's storage is left as it is
+    char* data = malloc(capacity);
+    memcpy(data, out->data, out->length);
+    out->data = data;
   }
-  // Free the actual node (and value)
-  delete(node->next);
-  free_node(node);
+  out->owned = true;
+  out->capacity = capacity;
 }
 
-// Print Function
+static void put_char(PrintBuffer* out, char c) {
+  reserve(out, 1);
+  out->data[out->length++] = c;
+}
 
-void indent(int n) {
-  for (int i = 0; i < n; i++)
-    putchar('\t');
+static void put_text(PrintBuffer* out, const char* text, size_t length) {
+  reserve(out, length);
+  memcpy(out->data + out->length, text, length);
+  out->length += length;
+}
+
+static void put_str(PrintBuffer* out, const char* text) {
+  put_text(out, text, strlen(text));
+}
+
+static void put_unsigned(PrintBuffer* out, uint64_t value) {
+  char digits[20];
+  size_t n = sizeof(digits);
+  do {
+    digits[--n] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  put_text(out, digits + n, sizeof(digits) - n);
+}
+
+static void put_int(PrintBuffer* out, int value) {
+  if (value < 0) {
+    put_char(out, '-');
+    put_unsigned(out, -(int64_t) value);
+  } else {
+    put_unsigned(out, value);
+  }
+}
+
+// As printf("%f") has it: six decimals, rounded half to even from the
+// exact value of the float
+static void put_float(PrintBuffer* out, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if (bits >> 31)
+    put_char(out, '-');
+  uint32_t exponent = (bits >> 23) & 0xff;
+  uint64_t mantissa = bits & 0x7fffff;
+  if (exponent == 0xff) {
+    put_str(out, mantissa == 0 ? "inf" : "nan");
+    return;
+  }
+  // value = mantissa * 2^-shift
+  int shift;
+  if (exponent == 0) {
+    shift = 149;
+  } else {
+    mantissa |= 0x800000;
+    shift = 150 - (int) exponent;
+  }
+  if (shift <= 0 && shift > -40) {
+    put_unsigned(out, mantissa << -shift);
+    put_str(out, ".000000");
+    return;
+  }
+  if (shift <= 0) {
+    // Beyond 64 bits, which few literals are
+    char text[64];
+    int length = snprintf(text, sizeof(text), "%f", value < 0 ? -value : value);
+    put_text(out, text, length);
+    return;
+  }
+
+  uint64_t whole = shift < 64 ? mantissa >> shift : 0;
+  uint64_t fraction = shift < 64 ? mantissa & ((UINT64_C(1) << shift) - 1) : mantissa;
+  // fraction < 2^24, so its millionths fit in 64 bits
+  uint64_t scaled = fraction * 1000000;
+  uint64_t decimals = 0;
+  bool above_half = false, half = false;
+  if (shift < 64) {
+    decimals = scaled >> shift;
+    uint64_t rest = scaled & ((UINT64_C(1) << shift) - 1);
+    uint64_t halfway = UINT64_C(1) << (shift - 1);
+    above_half = rest > halfway;
+    half = rest == halfway;
+  }
+  if (above_half || (half && decimals % 2 == 1))
+    decimals++;
+  if (decimals == 1000000) {
+    whole++;
+    decimals = 0;
+  }
+
+  put_unsigned(out, whole);
+  char digits[7] = ".000000";
+  for (int i = 6; i > 0; i--) {
+    digits[i] = '0' + decimals % 10;
+    decimals /= 10;
+  }
+  put_text(out, digits, sizeof(digits));
+}
+
+static void indent(PrintBuffer* out, int n) {
+  if (n == 0)
+    return;
+  reserve(out, n);
+  memset(out->data + out->length, '\t', n);
+  out->length += n;
 }
 
 const char* type_to_str(TypeNode* type) {
@@ -212,481 +391,590 @@ void print_type(TypeNode* type) {
   printf("%s", type_to_str(type));
 }
 
-void print_variable(VariableNode* var) {
-  printf("%s", var->identifier);
+static void print_offset(PrintBuffer* out, Node* node, int offset);
+
+static void print_variable(PrintBuffer* out, VariableNode* var) {
+  put_str(out, var->identifier);
   if (var->index != NULL) {
-    printf("[");
-    print(var->index);
-    printf("]");
+    put_char(out, '[');
+    print_offset(out, var->index, 0);
+    put_char(out, ']');
+  }
+  if (var->field != NULL) {
+    put_char(out, '$');
+    put_str(out, var->field);
   }
-  if (var->field != NULL)
-    printf("$%s", var->field);
 }
 
-void print_offset(Node* node, int offset) {
-  if (node == NULL)
-    return;
-  // Type-specific internal frees
+// Prints a single node, but not its siblings
+static void print_node(PrintBuffer* out, Node* node, int offset) {
   switch (node->type) {
     case INT:
-      indent(offset);
-      printf("%d", node->value->int_node);
+      indent(out, offset);
+      put_int(out, node->value->int_node);
       break;
     case FLOAT:
-      indent(offset);
-      printf("%f", node->value->float_node);
+      indent(out, offset);
+      put_float(out, node->value->float_node);
       break;
     case BOOL:
-      indent(offset);
+      indent(out, offset);
       if (node->value->bool_node)
-        printf("true");
+        put_str(out, "true");
       else
-        printf("false");
+        put_str(out, "false");
       break;
     case CHAR:
-      indent(offset);
-      printf("'%c'", node->value->char_node);
+      indent(out, offset);
+      put_char(out, '\'');
+      put_char(out, node->value->char_node);
+      put_char(out, '\'');
       break;
     case STRING:
-      indent(offset);
-      printf("\"%s\"", node->value->string_node);
+      indent(out, offset);
+      put_char(out, '"');
+      put_text(out, node->value->string_node.text, node->value->string_node.length);
+      put_char(out, '"');
       break;
     case VARIABLE:
-      indent(offset);
+      indent(out, offset);
       VariableNode var = node->value->var_node;
-      printf("%s", var.identifier);
+      put_str(out, var.identifier);
       if (var.index != NULL) {
-        printf("[");
-        print_offset(var.index, 0);
-        printf("]");
+        put_char(out, '[');
+        print_offset(out, var.index, 0);
+        put_char(out, ']');
+      }
+      if (var.field != NULL) {
+        put_char(out, '$');
+        put_str(out, var.field);
       }
-      if (var.field != NULL)
-        printf("$%s", var.field);
       break;
-    case BIN_OP:
-      indent(offset);
-      BinOpNode bin = node->value->bin_op_node;
-      if (bin.type != BASH_PIPE && bin.type != FORWARD_PIPE)
-        printf("(");
-      print_offset(bin.left, 0);
-
-      switch (bin.type) {
-        case ADD:
-          printf(" + ");
-          break;
-        case SUBTRACT:
-          printf(" - ");
-          break;
-        case MULTIPLY:
-          printf(" * ");
-          break;
-        case DIVIDE:
-          printf(" / ");
-          break;
-        case MODULO:
-          printf(" %% ");
-          break;
-        case POW:
-          printf(" ^ ");
-          break;
-        case GREATER:
-          printf(" > ");
-          break;
-        case LESS_THAN:
-          printf(" < ");
-          break;
-        case GREATER_EQUAL:
-          printf(" >= ");
-          break;
-        case LESS_EQUAL:
-          printf(" <= ");
-          break;
-        case EQUAL:
-          printf(" == ");
-          break;
-        case NOT_EQUAL:
-          printf(" != ");
-          break;
-        case AND:
-          printf(" && ");
-          break;
-        case OR:
-          printf(" || ");
-          break;
-        case BIT_AND:
-          printf(" & ");
-          break;
-        case BIT_OR:
-          printf(" | ");
-          break;
-        case BASH_PIPE:
-          printf(" %%|%% ");
-          break;
-        case FORWARD_PIPE:
-          printf(" %%>%% ");
-          break;
+    case BIN_OP: {
+      indent(out, offset);
+      // Down the left operands with a stack, then back up printing the
+      // operators and right operands
+      NodeStack spine = {0};
+      Node* left = node;
+      while (left->type == BIN_OP) {
+        BinOpType type = left->value->bin_op_node.type;
+        if (type != BASH_PIPE && type != FORWARD_PIPE)
+          put_char(out, '(');
+        push_node(&spine, left);
+        left = left->value->bin_op_node.left;
       }
+      print_offset(out, left, 0);
 
-      print_offset(bin.right, 0);
-      if (bin.type != BASH_PIPE && bin.type != FORWARD_PIPE)
-        printf(")");
-      break;
+      while (spine.count > 0) {
+        BinOpNode bin = pop_node(&spine)->value->bin_op_node;
+        switch (bin.type) {
+          case ADD:
+            put_str(out, " + ");
+            break;
+          case SUBTRACT:
+            put_str(out, " - ");
+            break;
+          case MULTIPLY:
+            put_str(out, " * ");
+            break;
+          case DIVIDE:
+            put_str(out, " / ");
+            break;
+          case MODULO:
+            put_str(out, " % ");
+            break;
+          case POW:
+            put_str(out, " ^ ");
+            break;
+          case GREATER:
+            put_str(out, " > ");
+            break;
+          case LESS_THAN:
+            put_str(out, " < ");
+            break;
+          case GREATER_EQUAL:
+            put_str(out, " >= ");
+            break;
+          case LESS_EQUAL:
+            put_str(out, " <= ");
+            break;
+          case EQUAL:
+            put_str(out, " == ");
+            break;
+          case NOT_EQUAL:
+            put_str(out, " != ");
+            break;
+          case AND:
+            put_str(out, " && ");
+            break;
+          case OR:
+            put_str(out, " || ");
+            break;
+          case BIT_AND:
+            put_str(out, " & ");
+            break;
+          case BIT_OR:
+            put_str(out, " | ");
+            break;
+          case BASH_PIPE:
+            put_str(out, " %|% ");
+            break;
+          case FORWARD_PIPE:
+            put_str(out, " %>% ");
+            break;
+        }
+
+        print_offset(out, bin.right, 0);
+        if (bin.type != BASH_PIPE && bin.type != FORWARD_PIPE)
+          put_char(out, ')');
+      }
+      free_stack(&spine);
+      break; }
     case UN_OP:
-      indent(offset);
+      indent(out, offset);
 
       UnOpNode un = node->value->un_op_node;
-      printf("(");
+      put_char(out, '(');
 
       switch (un.type) {
         case NOT:
-          printf("!");
+          put_char(out, '!');
           break;
         case MINUS:
-          printf("-");
+          put_char(out, '-');
           break;
         case PLUS:
-          printf("+");
+          put_char(out, '+');
           break;
         case ADDRESS:
-          printf("&");
+          put_char(out, '&');
           break;
         case VALUE:
-          printf("*");
+          put_char(out, '*');
           break;
         case EVAL_BOOL:
-          printf("?");
+          put_char(out, '?');
           break;
         case HASH:
-          printf("#");
+          put_char(out, '#');
           break;
       }
 
-      print_offset(un.value, 0);
-      printf(")");
+      print_offset(out, un.value, 0);
+      put_char(out, ')');
       break;
     case TERN_OP:
-      indent(offset);
+      indent(out, offset);
       TernOpNode tern = node->value->tern_op_node;
-      printf("(");
-      print_offset(tern.cond, 0);
-      printf(" ? ");
-      print_offset(tern.exp1, 0);
-      printf(" : ");
-      print_offset(tern.exp2, 0);
-      printf(")");
+      put_char(out, '(');
+      print_offset(out, tern.cond, 0);
+      put_str(out, " ? ");
+      print_offset(out, tern.exp1, 0);
+      put_str(out, " : ");
+      print_offset(out, tern.exp2, 0);
+      put_char(out, ')');
       break;
     case TYPE_DECL:
-      indent(offset);
+      indent(out, offset);
       TypeDeclNode decl = node->value->type_decl_node;
-      printf("class %s [\n", decl.identifier);
+      put_str(out, "class ");
+      put_str(out, decl.identifier);
+      put_str(out, " [\n");
 
       FieldNode* f = decl.field;
       while (f != NULL) {
-        indent(offset+1);
+        indent(out, offset+1);
         switch (f->scope) {
           case PRIVATE:
-            printf("private ");
+            put_str(out, "private ");
             break;
           case PUBLIC:
-            printf("public ");
+            put_str(out, "public ");
             break;
           case PROTECTED:
-            printf("protected ");
+            put_str(out, "protected ");
             break;
           case NO_SCOPE:
             break;
         }
-        print_type(f->type);
-        printf(" %s%s\n", f->identifier, f->next == NULL ? "" : " :");
+        put_str(out, type_to_str(f->type));
+        put_char(out, ' ');
+        put_str(out, f->identifier);
+        put_str(out, f->next == NULL ? "\n" : " :\n");
         f = f->next;
       }
 
-      indent(offset);
-      printf("];");
+      indent(out, offset);
+      put_str(out, "];");
       break;
     case GLOBAL_VAR_DECL:
-      indent(offset);
+      indent(out, offset);
       GlobalVarNode var_decl = node->value->global_var_node;
-      printf("%s", var_decl.identifier);
-      if (var_decl.array_size >= 0)
-        printf("[%d]", var_decl.array_size);
+      put_str(out, var_decl.identifier);
+      if (var_decl.array_size >= 0) {
+        put_char(out, '[');
+        put_int(out, var_decl.array_size);
+        put_char(out, ']');
+      }
       if (var_decl.is_static)
-        printf(" static");
-      printf(" ");
-      print_type(var_decl.type);
-      printf(";");
+        put_str(out, " static");
+      put_char(out, ' ');
+      put_str(out, type_to_str(var_decl.type));
+      put_char(out, ';');
       break;
     case FUNCTION_DECL:
-      indent(offset);
+      indent(out, offset);
       FunctionDeclNode func_decl = node->value->function_decl_node;
       if (func_decl.is_static)
-        printf("static ");
-      print_type(func_decl.type);
-      printf(" %s(", func_decl.identifier);
+        put_str(out, "static ");
+      put_str(out, type_to_str(func_decl.type));
+      put_char(out, ' ');
+      put_str(out, func_decl.identifier);
+      put_char(out, '(');
 
       ParamNode* param = func_decl.param;
       while (param != NULL) {
         if (param->is_const)
-          printf("const ");
-		print_type(param->type);
-		printf(" %s", param->identifier);
+          put_str(out, "const ");
+		put_str(out, type_to_str(param->type));
+		put_char(out, ' ');
+		put_str(out, param->identifier);
 		if (param->next != NULL)
-			printf(", ");
+			put_str(out, ", ");
 	  param = param->next;
       }
-      printf(") ");
-      print_offset(func_decl.body, 0);
+      put_str(out, ") ");
+      print_offset(out, func_decl.body, 0);
       break;
     case VAR_DECL:
-      indent(offset);
+      indent(out, offset);
       LocalVarNode local_var_decl = node->value->local_var_node;
       if (local_var_decl.is_static)
-        printf("static ");
+        put_str(out, "static ");
       if (local_var_decl.is_const)
-        printf("const ");
-      print_type(local_var_decl.type);
-      printf(" %s", local_var_decl.identifier);
+        put_str(out, "const ");
+      put_str(out, type_to_str(local_var_decl.type));
+      put_char(out, ' ');
+      put_str(out, local_var_decl.identifier);
       if (local_var_decl.init != NULL) {
-        printf(" <= ");
-        print_offset(local_var_decl.init, 0);
+        put_str(out, " <= ");
+        print_offset(out, local_var_decl.init, 0);
       }
       break;
     case ATTR:
-      indent(offset);
+      indent(out, offset);
       AttrNode attr = node->value->attr_node;
-      print_variable(attr.var);
-      printf(" = ");
-      print_offset(attr.value, 0);
+      print_variable(out, attr.var);
+      put_str(out, " = ");
+      print_offset(out, attr.value, 0);
       break;
     case SHIFT_L:
-      indent(offset);
+      indent(out, offset);
       AttrNode shift_l = node->value->shift_l_node;
-      print_variable(shift_l.var);
-      printf(" << ");
-      print_offset(shift_l.value, 0);
+      print_variable(out, shift_l.var);
+      put_str(out, " << ");
+      print_offset(out, shift_l.value, 0);
       break;
     case SHIFT_R:
-      indent(offset);
+      indent(out, offset);
       AttrNode shift_r = node->value->shift_r_node;
-      print_variable(shift_r.var);
-      printf(" >> ");
-      print_offset(shift_r.value, 0);
+      print_variable(out, shift_r.var);
+      put_str(out, " >> ");
+      print_offset(out, shift_r.value, 0);
       break;
     case FUNCTION_CALL: {
-      indent(offset);
+      indent(out, offset);
       FunctionCallNode func_call = node->value->function_call_node;
-      printf("%s(", func_call.identifier);
+      put_str(out, func_call.identifier);
+      put_char(out, '(');
       Node* value = func_call.arguments;
       while (value != NULL) {
-        print_offset(value, 0);
+        print_offset(out, value, 0);
         if (value->next)
-          printf(", ");
+          put_str(out, ", ");
         value = value->next;
       }
-      printf(")");
+      put_char(out, ')');
       break; }
     case DOT: {
-      indent(offset);
-      printf(".");
+      indent(out, offset);
+      put_char(out, '.');
       break; }
     case RETURN: {
-      indent(offset);
+      indent(out, offset);
       ListNode ret = node->value->return_node;
-      printf("return ");
-      print_offset(ret.value, 0);
+      put_str(out, "return ");
+      print_offset(out, ret.value, 0);
       break; }
     case INPUT: {
-      indent(offset);
+      indent(out, offset);
       ListNode input = node->value->input_node;
-      printf("input ");
-      print_offset(input.value, 0);
+      put_str(out, "input ");
+      print_offset(out, input.value, 0);
       break; }
     case OUTPUT: {
-      indent(offset);
+      indent(out, offset);
       ListNode output = node->value->output_node;
-      printf("output ");
+      put_str(out, "output ");
       Node* value = output.value;
       while (value != NULL) {
-        print_offset(value, 0);
+        print_offset(out, value, 0);
         if (value->next)
-          printf(", ");
+          put_str(out, ", ");
         value = value->next;
       }
       break; }
     case BREAK: {
-      indent(offset);
-      printf("break");
+      indent(out, offset);
+      put_str(out, "break");
       break; }
     case CONTINUE: {
-      indent(offset);
-      printf("continue");
+      indent(out, offset);
+      put_str(out, "continue");
       break; }
     case CASE: {
-      indent(offset);
-      printf("case %d:", node->value->case_node);
+      indent(out, offset);
+      put_str(out, "case ");
+      put_int(out, node->value->case_node);
+      put_char(out, ':');
       break; }
     case BLOCK: {
-      indent(offset);
+      indent(out, offset);
       ListNode block = node->value->block_node;
-      printf("{\n");
+      put_str(out, "{\n");
       Node* value = block.value;
       while (value != NULL) {
-        print_offset(value, offset+1);
+        print_offset(out, value, offset+1);
         if (value->type != CASE)
-          printf(";\n");
+          put_str(out, ";\n");
         else
-          printf("\n");
+          put_char(out, '\n');
         value = value->next;
       }
-      indent(offset);
-      printf("}");
+      indent(out, offset);
+      put_char(out, '}');
       break; }
     case IF: {
-      indent(offset);
+      indent(out, offset);
       IfNode iff = node->value->if_node;
-      printf("if (");
-      print_offset(iff.cond, 0);
-      printf(") then\n");
-      print_offset(iff.then, offset);
-      printf("\n");
-      indent(offset);
+      put_str(out, "if (");
+      print_offset(out, iff.cond, 0);
+      put_str(out, ") then\n");
+      print_offset(out, iff.then, offset);
+      put_char(out, '\n');
+      indent(out, offset);
       if (iff.else_node != NULL) {
-        printf("else\n");
-        print_offset(iff.else_node, offset);
+        put_str(out, "else\n");
+        print_offset(out, iff.else_node, offset);
       }
       break; }
     case WHILE: {
-      indent(offset);
+      indent(out, offset);
       WhileNode whilee = node->value->while_node;
-      printf("while (");
-      print_offset(whilee.cond, 0);
-      printf(") do\n");
-      print_offset(whilee.body, offset);
+      put_str(out, "while (");
+      print_offset(out, whilee.cond, 0);
+      put_str(out, ") do\n");
+      print_offset(out, whilee.body, offset);
       break; }
     case DO_WHILE: {
-      indent(offset);
+      indent(out, offset);
       WhileNode whilee = node->value->do_while_node;
-      printf("do\n");
-      print_offset(whilee.body, offset);
-      printf(" while (");
-      print_offset(whilee.cond, 0);
-      printf(")");
+      put_str(out, "do\n");
+      print_offset(out, whilee.body, offset);
+      put_str(out, " while (");
+      print_offset(out, whilee.cond, 0);
+      put_char(out, ')');
       break; }
     case SWITCH: {
-      indent(offset);
+      indent(out, offset);
       SwitchNode switchh = node->value->switch_node;
-      printf("switch (");
-      print_offset(switchh.expression, 0);
-      printf(")\n");
-      print_offset(switchh.body, offset);
+      put_str(out, "switch (");
+      print_offset(out, switchh.expression, 0);
+      put_str(out, ")\n");
+      print_offset(out, switchh.body, offset);
       break; }
     case FOR: {
-      indent(offset);
+      indent(out, offset);
       ForNode forr = node->value->for_node;
-      printf("for (");
+      put_str(out, "for (");
       Node* init = forr.initializers;
       while (init != NULL) {
-        print_offset(init, 0);
+        print_offset(out, init, 0);
         if (init->next != NULL)
-          printf(", ");
+          put_str(out, ", ");
         init = init->next;
       }
-      printf(" : ");
-      print_offset(forr.expressions, 0);
-      printf(" : ");
+      put_str(out, " : ");
+      print_offset(out, forr.expressions, 0);
+      put_str(out, " : ");
       Node* command = forr.commands;
       while (command != NULL) {
-        print_offset(command, 0);
+        print_offset(out, command, 0);
         if (command->next != NULL)
-          printf(", ");
+          put_str(out, ", ");
         command = command->next;
       }
-      printf(")\n");
-      print_offset(forr.body, offset);
+      put_str(out, ")\n");
+      print_offset(out, forr.body, offset);
       break; }
     case FOR_EACH: {
-      indent(offset);
+      indent(out, offset);
       ForEachNode for_each = node->value->for_each_node;
-      printf("foreach (%s : ", for_each.id);
+      put_str(out, "foreach (");
+      put_str(out, for_each.id);
+      put_str(out, " : ");
       Node* expr = for_each.expression;
       while (expr != NULL) {
-        print_offset(expr, 0);
+        print_offset(out, expr, 0);
         if (expr->next != NULL)
-          printf(", ");
+          put_str(out, ", ");
         expr = expr->next;
       }
-      printf(")\n");
-      print_offset(for_each.body, offset);
+      put_str(out, ")\n");
+      print_offset(out, for_each.body, offset);
       break; }
   }
+}
 
-  if (node->next == NULL)
-    return;
-
-  if (node->type == TYPE_DECL
-    || node->type == GLOBAL_VAR_DECL
-    || node->type == FUNCTION_DECL) {
-    printf("\n\n");
-    print_offset(node->next, offset);
-  // } else {
-  //   printf("\n");
-  //   print_offset(node->next, offset);
+// Global declarations go on to their siblings in a loop: a program has any
+// number of them
+static void print_offset(PrintBuffer* out, Node* node, int offset) {
+  while (node != NULL) {
+    print_node(out, node, offset);
+    if (node->type != TYPE_DECL
+      && node->type != GLOBAL_VAR_DECL
+      && node->type != FUNCTION_DECL)
+      return;
+    if (node->next != NULL)
+      put_str(out, "\n\n");
+    node = node->next;
   }
+}
+
+void print_to(PrintBuffer* buffer, Node* node) {
+  print_offset(buffer, node, 0);
+}
+
+void free_buffer(PrintBuffer* buffer) {
+  if (buffer->owned)
+    free(buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+  buffer->owned = false;
+}
 
+static void write_out(PrintBuffer* buffer) {
+  fwrite(buffer->data, 1, buffer->length, stdout);
+  free_buffer(buffer);
 }
 
 void print(Node* node) {
-  print_offset(node, 0);
+  PrintBuffer buffer = {0};
+  print_to(&buffer, node);
+  write_out(&buffer);
 }
 
 void descompila(Node* arvore) {
-  print_offset(arvore, 0);
-  printf("\n");
+  PrintBuffer buffer = {0};
+  print_to(&buffer, arvore);
+  put_char(&buffer, '\n');
+  write_out(&buffer);
 }
 
 // Construction Functions
 
 Node* make_int(int value) {
+  Arena* arena = arena_in_use();
+  if (arena->share) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.int_node = value;
+    return make_shared(arena, INT, &v, 0);
+  }
   Node* n = make_node(INT);
   n->value->int_node = value;
   return n;
 }
 
 Node* make_float(float value) {
+  Arena* arena = arena_in_use();
+  if (arena->share) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.float_node = value;
+    return make_shared(arena, FLOAT, &v, 0);
+  }
   Node* n = make_node(FLOAT);
   n->value->float_node = value;
   return n;
 }
 
 Node* make_bool(bool value) {
+  Arena* arena = arena_in_use();
+  if (arena->share) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.bool_node = value;
+    return make_shared(arena, BOOL, &v, 0);
+  }
   Node* n = make_node(BOOL);
   n->value->bool_node = value;
   return n;
 }
 
 Node* make_char(char value) {
+  Arena* arena = arena_in_use();
+  if (arena->share) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.char_node = value;
+    return make_shared(arena, CHAR, &v, 0);
+  }
   Node* n = make_node(CHAR);
   n->value->char_node = value;
   return n;
 }
 
-Node* make_string(char* value) {
+// String literals are not shared: equal ones are still different views
+Node* make_string(StringNode value) {
   Node* n = make_node(STRING);
   n->value->string_node = value;
   return n;
 }
 
-Node* make_variable(Token token, Node* index, char* field) {
+// Expressions are only shared when all their operands are: an operand
+// that is not, like a function call, may have side effects
+
+Node* make_variable(Token token, Node* index, Atom field) {
+  Arena* arena = arena_in_use();
+  if (arena->share && (index == NULL || index->shared)) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.var_node.identifier = token.value.identifier;
+    v.var_node.index = index;
+    v.var_node.field = field;
+    return make_shared(arena, VARIABLE, &v, token.offset);
+  }
   Node* n = make_node(VARIABLE);
-  n->line = token.line;
-  n->column = token.column;
+  n->offset = token.offset;
   n->value->var_node.identifier = token.value.identifier;
   n->value->var_node.index = index;
   n->value->var_node.field = field;
+  n->value->var_node.storage = 0;
   return n;
 }
 
 Node* make_bin_op(Node* left, BinOpType type, Node* right) {
+  Arena* arena = arena_in_use();
+  if (arena->share && left->shared && right->shared) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.bin_op_node.left = left;
+    v.bin_op_node.right = right;
+    v.bin_op_node.type = type;
+    return make_shared(arena, BIN_OP, &v, 0);
+  }
   Node* n = make_node(BIN_OP);
   n->value->bin_op_node.left = left;
   n->value->bin_op_node.right = right;
@@ -695,6 +983,14 @@ Node* make_bin_op(Node* left, BinOpType type, Node* right) {
 }
 
 Node* make_un_op(Node* value, UnOpType type) {
+  Arena* arena = arena_in_use();
+  if (arena->share && value->shared) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.un_op_node.value = value;
+    v.un_op_node.type = type;
+    return make_shared(arena, UN_OP, &v, 0);
+  }
   Node* n = make_node(UN_OP);
   n->value->un_op_node.value = value;
   n->value->un_op_node.type = type;
@@ -702,6 +998,15 @@ Node* make_un_op(Node* value, UnOpType type) {
 }
 
 Node* make_tern_op(Node* cond, Node* exp1, Node* exp2) {
+  Arena* arena = arena_in_use();
+  if (arena->share && cond->shared && exp1->shared && exp2->shared) {
+    union NodeValue v;
+    memset(&v, 0, sizeof(v));
+    v.tern_op_node.cond = cond;
+    v.tern_op_node.exp1 = exp1;
+    v.tern_op_node.exp2 = exp2;
+    return make_shared(arena, TERN_OP, &v, 0);
+  }
   Node* n = make_node(TERN_OP);
   n->value->tern_op_node.cond = cond;
   n->value->tern_op_node.exp1 = exp1;
@@ -709,29 +1014,77 @@ Node* make_tern_op(Node* cond, Node* exp1, Node* exp2) {
   return n;
 }
 
-TypeNode* make_type(TypeKind kind, char* name) {
-  TypeNode* n = (TypeNode*) malloc(sizeof(TypeNode));
-  n->kind = kind;
-  if (kind == CUSTOM_T)
-    n->name = name;
-  else
-    n->name = NULL;
+// Types are never changed once made, but for the size of classes, so
+// those of the language are shared by every arena and thread
+static TypeNode builtin_types[] = {
+  [INT_T] = { INT_T, NULL, 0, 4 },
+  [FLOAT_T] = { FLOAT_T, NULL, 0, 8 },
+  [CHAR_T] = { CHAR_T, NULL, 0, 1 },
+  [STRING_T] = { STRING_T, NULL, 0, 0 },
+  [BOOL_T] = { BOOL_T, NULL, 0, 1 },
+};
+
+static size_t type_hash(Atom name) {
+  uint64_t h = (uintptr_t) name;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void grow_types(Arena* arena) {
+  size_t capacity = arena->type_capacity == 0 ? 64 : 2 * arena->type_capacity;
+  TypeNode** types = calloc(capacity, sizeof(TypeNode*));
+  for (size_t i = 0; i < arena->type_capacity; i++) {
+    TypeNode* type = arena->types[i];
+    if (type == NULL)
+      continue;
+    size_t slot = type_hash(type->name) & (capacity - 1);
+    while (types[slot] != NULL)
+      slot = (slot + 1) & (capacity - 1);
+    types[slot] = type;
+  }
+  free(arena->types);
+  arena->types = types;
+  arena->type_capacity = capacity;
+}
+
+TypeNode* make_type(TypeKind kind, Atom name) {
+  if (kind != CUSTOM_T)
+    return &builtin_types[kind];
+
+  Arena* arena = arena_in_use();
+  if (2 * (arena->type_count + 1) > arena->type_capacity)
+    grow_types(arena);
+  size_t mask = arena->type_capacity - 1;
+  size_t slot = type_hash(name) & mask;
+  for (TypeNode* type; (type = arena->types[slot]) != NULL; slot = (slot + 1) & mask)
+    if (type->name == name)
+      return type;
+
+  TypeNode* n = allocate(sizeof(TypeNode));
+  n->kind = CUSTOM_T;
+  n->name = name;
+  n->sized_in = 0;
+  n->size = -1;
+  arena->types[slot] = n;
+  arena->type_count++;
   return n;
 }
 
 Node* make_global_var(TypeNode* type, Token token, bool is_static, int array_size) {
   Node* n = make_node(GLOBAL_VAR_DECL);
-  n->line = token.line;
-  n->column = token.column;
+  n->offset = token.offset;
   n->value->global_var_node.type = type;
   n->value->global_var_node.identifier = token.value.identifier;
   n->value->global_var_node.is_static = is_static;
   n->value->global_var_node.array_size = array_size;
+  n->value->global_var_node.storage = 0;
   return n;
 }
 
-FieldNode* make_field(Scope scope, TypeNode* type, char* id) {
-  FieldNode* n = (FieldNode*) malloc(sizeof(FieldNode));
+FieldNode* make_field(Scope scope, TypeNode* type, Atom id) {
+  FieldNode* n = allocate(sizeof(FieldNode));
   n->scope = scope;
   n->type = type;
   n->identifier = id;
@@ -741,17 +1094,15 @@ FieldNode* make_field(Scope scope, TypeNode* type, char* id) {
 
 Node* make_type_decl(Token token, FieldNode* field) {
   Node* n = make_node(TYPE_DECL);
-  n->line = token.line;
-  n->column = token.column;
+  n->offset = token.offset;
   n->value->type_decl_node.identifier = token.value.identifier;
   n->value->type_decl_node.field = field;
   return n;
 }
 
 ParamNode* make_param(bool is_const, TypeNode* type, Token token) {
-  ParamNode* n = (ParamNode*) malloc(sizeof(ParamNode));
-  n->line = token.line;
-  n->column = token.column;
+  ParamNode* n = allocate(sizeof(ParamNode));
+  n->offset = token.offset;
   n->is_const = is_const;
   n->type = type;
   n->identifier = token.value.identifier;
@@ -761,8 +1112,7 @@ ParamNode* make_param(bool is_const, TypeNode* type, Token token) {
 
 Node* make_function_decl(TypeNode* type, Token token, bool is_static, ParamNode* param, Node* body) {
   Node* n = make_node(FUNCTION_DECL);
-  n->line = token.line;
-  n->column = token.column;
+  n->offset = token.offset;
   n->value->function_decl_node.type = type;
   n->value->function_decl_node.identifier = token.value.identifier;
   n->value->function_decl_node.is_static = is_static;
@@ -773,77 +1123,44 @@ Node* make_function_decl(TypeNode* type, Token token, bool is_static, ParamNode*
 
 Node* make_local_var(TypeNode* type, Token token, bool is_static, bool is_const, Node* init) {
   Node* n = make_node(VAR_DECL);
-  n->line = token.line;
-  n->column = token.column;
+  n->offset = token.offset;
   n->value->local_var_node.type = type;
   n->value->local_var_node.identifier = token.value.identifier;
   n->value->local_var_node.is_static = is_static;
   n->value->local_var_node.is_const = is_const;
+  n->value->local_var_node.storage = 0;
   n->value->local_var_node.init = init;
   return n;
 }
 
-Node* make_attr(Node* node_var, Node* value) {
-  VariableNode old_var = node_var->value->var_node;
-  VariableNode* new_var = (VariableNode*)malloc(sizeof(VariableNode));
-  new_var->field = old_var.field;
-  new_var->identifier = old_var.identifier;
-  new_var->index = old_var.index;
-
-  old_var.field = NULL;
-  old_var.identifier = NULL;
-  old_var.index = NULL;
-
-  free(node_var->value);
-  free(node_var);
+// The variable node stays where it is in the arena. A shared one is copied
+// first, since the checker numbers the target after its declaration.
 
+Node* make_attr(Node* node_var, Node* value) {
+  node_var = unshared(node_var);
   Node* n = make_node(ATTR);
-  n->value->attr_node.var = new_var;
+  n->value->attr_node.var = &node_var->value->var_node;
   n->value->attr_node.value = value;
   return n;
 }
 
 Node* make_shift_l(Node* node_var, Node* value) {
-  VariableNode old_var = node_var->value->var_node;
-  VariableNode* new_var = (VariableNode*)malloc(sizeof(VariableNode));
-  new_var->field = old_var.field;
-  new_var->identifier = old_var.identifier;
-  new_var->index = old_var.index;
-
-  old_var.field = NULL;
-  old_var.identifier = NULL;
-  old_var.index = NULL;
-
-  free(node_var->value);
-  free(node_var);
-
+  node_var = unshared(node_var);
   Node* n = make_node(SHIFT_L);
-  n->value->shift_l_node.var = new_var;
+  n->value->shift_l_node.var = &node_var->value->var_node;
   n->value->shift_l_node.value = value;
   return n;
 }
 
 Node* make_shift_r(Node* node_var, Node* value) {
-  VariableNode old_var = node_var->value->var_node;
-  VariableNode* new_var = (VariableNode*)malloc(sizeof(VariableNode));
-  new_var->field = old_var.field;
-  new_var->identifier = old_var.identifier;
-  new_var->index = old_var.index;
-
-  old_var.field = NULL;
-  old_var.identifier = NULL;
-  old_var.index = NULL;
-
-  free(node_var->value);
-  free(node_var);
-
+  node_var = unshared(node_var);
   Node* n = make_node(SHIFT_R);
-  n->value->shift_r_node.var = new_var;
+  n->value->shift_r_node.var = &node_var->value->var_node;
   n->value->shift_r_node.value = value;
   return n;
 }
 
-Node* make_function_call(char* id, Node* arguments) {
+Node* make_function_call(Atom id, Node* arguments) {
   Node* n = make_node(FUNCTION_CALL);
   n->value->function_call_node.identifier = id;
   n->value->function_call_node.arguments = arguments;
@@ -851,11 +1168,7 @@ Node* make_function_call(char* id, Node* arguments) {
 }
 
 Node* make_dot() {
-  Node* n = (Node*) malloc(sizeof(Node));
-  n->type = DOT;
-  n->value = NULL;
-  n->next = NULL;
-  return n;
+  return make_node(DOT);
 }
 
 Node* make_return(Node* value) {
@@ -865,19 +1178,11 @@ Node* make_return(Node* value) {
 }
 
 Node* make_break() {
-  Node* n = (Node*) malloc(sizeof(Node));
-  n->type = BREAK;
-  n->value = NULL;
-  n->next = NULL;
-  return n;
+  return make_node(BREAK);
 }
 
 Node* make_continue() {
-  Node* n = (Node*) malloc(sizeof(Node));
-  n->type = CONTINUE;
-  n->value = NULL;
-  n->next = NULL;
-  return n;
+  return make_node(CONTINUE);
 }
 
 Node* make_case(int value) {
@@ -912,7 +1217,7 @@ Node* make_if(Node* cond, Node* then, Node* else_node) {
   return n;
 }
 
-Node* make_for_each(char* id, Node* expression, Node* body) {
+Node* make_for_each(Atom id, Node* expression, Node* body) {
   Node* n = make_node(FOR_EACH);
   n->value->for_each_node.id = id;
   n->value->for_each_node.expression = expression;
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "intern.h"
 
 // Definition of nodes
 
@@ -46,8 +48,6 @@ typedef enum {
   FOR_EACH,
 } NodeType;
 
-union NodeValue;
-
 // ENUMS
 
 typedef enum {
@@ -97,13 +97,7 @@ typedef enum {
   NO_SCOPE
 } Scope;
 
-typedef struct Node {
-  int line, column;
-  NodeType type;
-  TypeKind coerced_to;
-  union NodeValue* value;
-  struct Node* next;
-} Node;
+typedef struct Node Node;
 
 // Operator Nodes
 
@@ -126,45 +120,64 @@ typedef struct {
 
 // Helper Nodes
 
+// There is one of each type: make_type hands out the same node for every
+// mention of it
 typedef struct {
   TypeKind kind;
-  char* name;
+  Atom name;
+  // The size of a class, as the check with the given id found it: each
+  // check has classes of its own, see size_for_type. The code generated
+  // after the check reads it too, see slot_size.
+  unsigned long sized_in;
+  int size;
 } TypeNode;
 
+// String literals carry their byte length from the scanner onward, so no
+// later phase has to rescan them
+typedef struct {
+  const char* text; // Atom, or a view into the source: not NUL terminated
+  size_t length;
+} StringNode;
+
 typedef struct FieldNode {
   Scope scope;
   TypeNode* type;
-  char* identifier;
+  Atom identifier;
 
   struct FieldNode* next;
 } FieldNode;
 
 typedef struct ParamNode {
-  int line, column;
+  uint32_t offset;
   bool is_const;
   TypeNode* type;
-  char* identifier;
+  Atom identifier;
 
   struct ParamNode* next;
 } ParamNode;
 
 // Top-Level Construction Nodes
 
+// Declarations and variables are numbered by the checker after the
+// storage they refer to, so that codegen finds it without a lookup: 0 if
+// not checked yet, or not anything codegen stores
+
 typedef struct {
   TypeNode* type;
-  char* identifier;
+  Atom identifier;
   bool is_static;
   int array_size;
+  uint32_t storage;
 } GlobalVarNode;
 
 typedef struct {
-  char* identifier;
+  Atom identifier;
   FieldNode* field;
 } TypeDeclNode;
 
 typedef struct {
   TypeNode* type;
-  char* identifier;
+  Atom identifier;
   bool is_static;
 
   ParamNode* param;
@@ -176,17 +189,21 @@ typedef struct {
 
 typedef struct {
   TypeNode* type;
-  char* identifier;
+  Atom identifier;
   bool is_static;
   bool is_const;
+  uint32_t storage;
 
   Node* init;
 } LocalVarNode;
 
 typedef struct {
-  char* identifier;
+  Atom identifier;
   Node* index;
-  char* field;
+  Atom field;
+  // Left at 0 in shared nodes, which may stand for the variables of
+  // several scopes
+  uint32_t storage;
 } VariableNode;
 
 typedef struct {
@@ -196,7 +213,7 @@ typedef struct {
 } AttrNode;
 
 typedef struct {
-  char* identifier;
+  Atom identifier;
 
   Node* arguments;
 } FunctionCallNode;
@@ -212,7 +229,7 @@ typedef struct {
 } IfNode;
 
 typedef struct {
-  char* id;
+  Atom id;
   Node* expression;
   Node* body;
 } ForEachNode;
@@ -242,7 +259,7 @@ typedef union NodeValue {
   float float_node;
   bool bool_node;
   char char_node;
-  char* string_node;
+  StringNode string_node;
   VariableNode var_node;
 
   BinOpNode bin_op_node;
@@ -275,6 +292,19 @@ typedef union NodeValue {
   ForEachNode for_each_node;
 } NodeValue;
 
+// The value follows the header in the same allocation, with only the
+// bytes its member needs: `node->value` is no pointer of its own
+struct Node {
+  uint32_t offset; // In the source, see source_position
+  uint8_t type;       // NodeType
+  int8_t coerced_to;  // TypeKind, -1 if none
+  // Hash-consed, see share_expressions: it may be the operand of several
+  // nodes, and is never linked into a list
+  bool shared;
+  struct Node* next;
+  union NodeValue value[];
+};
+
 typedef enum  {
   TYPE_KEYWORD,
   SCOPE_KEYWORD,
@@ -293,43 +323,96 @@ typedef union {
   Scope scope;
   char special_char;
   BinOpType binary_operator;
-  char* identifier;
+  Atom identifier;
   int int_literal;
   float float_literal;
   char char_literal;
   bool bool_literal;
-  char* string_literal;
+  StringNode string_literal;
 } TokenValue;
 
 typedef struct Token {
-  int line;
-  int column;
+  uint32_t offset;
   TokenCategory category;
   TokenValue value;
 } Token;
 
-void delete(Node* node);
-void delete_field(FieldNode* node);
-void delete_param(ParamNode* node);
-void delete_type(TypeNode* type);
+// Bump allocator every node of a compilation comes from. The whole AST is
+// released at once, see libera.
+typedef struct Arena {
+  struct ArenaChunk* chunks; // Most recent first
+  char* next;
+  char* end;
+
+  // Expressions built so far, while they are hash-consed
+  bool share;
+  struct Node** shared;
+  size_t shared_count;
+  size_t shared_capacity;
+
+  // The class types made so far, by name
+  TypeNode** types;
+  size_t type_count;
+  size_t type_capacity;
+} Arena;
+
+void init_arena(Arena* arena);
+void free_arena(Arena* arena);
+// Arena the make_* functions of the calling thread allocate from
+void use_arena(Arena* arena);
+// With `share` set, make_* returns the node already built for an identical
+// side-effect-free expression instead of a new one, so the AST becomes a
+// DAG. Sharing lasts until it is turned off, across free_arena.
+void share_expressions(Arena* arena, bool share);
+
+// Nodes still to be visited, for walks over trees too deep to recurse on:
+// the left operands of a chain like a+b+c+... nest as deep as it is long
+typedef struct NodeStack {
+  Node** items;
+  size_t count;
+  size_t capacity;
+} NodeStack;
+
+void push_node(NodeStack* stack, Node* node);
+Node* pop_node(NodeStack* stack);
+void free_stack(NodeStack* stack);
+
+// Text the decompiler writes into, grown as it fills up. It may start out
+// on storage of the caller's, which is left alone: the text moves to memory
+// of the buffer's own, and `owned` is set, when it no longer fits
+typedef struct {
+  char* data;
+  size_t length;
+  size_t capacity;
+  bool owned;
+} PrintBuffer;
+
+// Appends the decompiled subtree, without writing it anywhere
+void print_to(PrintBuffer* buffer, Node* node);
+void free_buffer(PrintBuffer* buffer);
 
 void print(Node* node);
 const char* type_to_str(TypeNode* type);
 void print_type(TypeNode* type);
 
+// A node of the given kind with its value left for the caller to fill in
+Node* make_node(NodeType type);
 Node* make_int(int value);
 Node* make_float(float value);
 Node* make_bool(bool value);
 Node* make_char(char value);
-Node* make_string(char* value);
-Node* make_variable(Token token, Node* index, char* field);
+Node* make_string(StringNode value);
+Node* make_variable(Token token, Node* index, Atom field);
 
 Node* make_bin_op(Node* left, BinOpType type, Node* right);
 Node* make_un_op(Node* value, UnOpType type);
 Node* make_tern_op(Node* cond, Node* exp1, Node* exp2);
+// The node itself, or a copy of it if it is shared, to be linked into a list
+Node* unshared(Node* node);
 
-TypeNode* make_type(TypeKind kind, char* name);
-FieldNode* make_field(Scope scope, TypeNode* type, char* id);
+// The one node of the type. Those of classes belong to the arena in use.
+TypeNode* make_type(TypeKind kind, Atom name);
+FieldNode* make_field(Scope scope, TypeNode* type, Atom id);
 ParamNode* make_param(bool is_const, TypeNode* type, Token token);
 
 Node* make_global_var(TypeNode* type, Token token, bool is_static, int array_size);
@@ -341,7 +424,7 @@ Node* make_attr(Node* var, Node* value);
 Node* make_shift_l(Node* var, Node* value);
 Node* make_shift_r(Node* var, Node* value);
 
-Node* make_function_call(char* id, Node* arguments);
+Node* make_function_call(Atom id, Node* arguments);
 Node* make_dot();
 
 Node* make_return(Node* value);
@@ -355,7 +438,7 @@ Node* make_output(Node* value);
 Node* make_block(Node* value);
 
 Node* make_if(Node* cond, Node* then, Node* else_node);
-Node* make_for_each(char* id, Node* expression, Node* body);
+Node* make_for_each(Atom id, Node* expression, Node* body);
 Node* make_for(Node* initializers, Node* expressions, Node* commands, Node* body);
 Node* make_while(Node* cond, Node* body);
 Node* make_do_while(Node* cond, Node* body);